@@ -0,0 +1,385 @@
+//=======================================================================
+// Copyright Baptiste Wicht 2013-2015.
+// Distributed under the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+//Micro-benchmarks of the kernels of the recognizer, in isolation. They
+//run on a synthetic grid and on the given images. All the random inputs
+//are generated from fixed seeds.
+
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <memory>
+
+#include <opencv2/opencv.hpp>
+
+#include "cpp_utils/stop_watch.hpp"
+
+//Defines DLL_SVM_SUPPORT, must come before the other DLL headers
+#include "networks.hpp"
+
+#include "batch.hpp"
+#include "binarize.hpp"
+#include "detector.hpp"
+#include "detector_kernels.hpp"
+#include "trig_utils.hpp"
+#include "image_utils.hpp"
+#include "config.hpp"
+#include "solver.hpp"
+#include "utils.hpp"
+
+namespace {
+
+constexpr const std::size_t default_repeat = 50;
+constexpr const std::size_t seed = 42;
+
+//One of the hardest known puzzles for backtracking solvers (17 clues)
+const auto hard_puzzle = "000000010400000000020000000000050407008000300001090000300400200050100000000806000";
+
+//Run functor once to warm up and then repeat times, the durations are in microseconds
+template<typename Functor>
+void bench(const std::string& name, std::size_t repeat, Functor&& functor){
+    functor();
+
+    std::vector<double> samples;
+
+    for(std::size_t r = 0; r < repeat; ++r){
+        cpp::stop_watch<std::chrono::microseconds> watch;
+
+        functor();
+
+        samples.push_back(watch.elapsed());
+    }
+
+    std::sort(samples.begin(), samples.end());
+
+    std::cout << std::left << std::setw(28) << name << std::right
+              << " min: " << std::setw(9) << min(samples)
+              << " p50: " << std::setw(9) << sorted_percentile(samples, 50)
+              << " p90: " << std::setw(9) << sorted_percentile(samples, 90)
+              << " max: " << std::setw(9) << max(samples) << std::endl;
+}
+
+//A slightly rotated grid with random digits
+cv::Mat synthetic_grid(std::mt19937& generator){
+    constexpr const int cell = 48;
+    constexpr const int margin = 40;
+    constexpr const int size = 9 * cell + 2 * margin;
+
+    cv::Mat image(size, size, CV_8UC3, cv::Scalar(255, 255, 255));
+
+    for(int i = 0; i < 10; ++i){
+        auto thickness = i % 3 == 0 ? 4 : 2;
+        auto p = margin + i * cell;
+
+        cv::line(image, cv::Point(p, margin), cv::Point(p, size - margin), cv::Scalar(0, 0, 0), thickness);
+        cv::line(image, cv::Point(margin, p), cv::Point(size - margin, p), cv::Scalar(0, 0, 0), thickness);
+    }
+
+    std::uniform_int_distribution<int> digit_dist(0, 20);
+
+    for(int y = 0; y < 9; ++y){
+        for(int x = 0; x < 9; ++x){
+            auto digit = digit_dist(generator);
+
+            if(digit >= 1 && digit <= 9){
+                cv::Point origin(margin + x * cell + 12, margin + (y + 1) * cell - 10);
+                cv::putText(image, std::to_string(digit), origin, cv::FONT_HERSHEY_SIMPLEX, 1.1, cv::Scalar(0, 0, 0), 2);
+            }
+        }
+    }
+
+    std::uniform_real_distribution<double> angle_dist(-4.0, 4.0);
+
+    auto rotation = cv::getRotationMatrix2D(cv::Point2f(size / 2.0f, size / 2.0f), angle_dist(generator), 1.0);
+
+    cv::Mat rotated;
+    cv::warpAffine(image, rotated, rotation, image.size(), cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar(255, 255, 255));
+
+    return rotated;
+}
+
+template<typename Layer>
+void randomize_layer(Layer& layer, std::mt19937& generator){
+    std::normal_distribution<double> distribution(0.0, 0.01);
+
+    for(std::size_t i = 0; i < etl::size(layer.w); ++i){
+        layer.w[i] = distribution(generator);
+    }
+
+    for(std::size_t i = 0; i < etl::size(layer.b); ++i){
+        layer.b[i] = distribution(generator);
+    }
+
+    for(std::size_t i = 0; i < etl::size(layer.c); ++i){
+        layer.c[i] = distribution(generator);
+    }
+}
+
+void bench_image(const std::string& name, const cv::Mat& source_image, dbn_t& dbn, std::size_t repeat){
+    std::cout << "== " << name << " (" << source_image.cols << "x" << source_image.rows << ")" << std::endl;
+
+    config conf;
+
+    //Run the detection once to get the inputs of all the kernels
+
+    detection_context context(source_image, conf);
+    cv::Mat dest_image = source_image.clone();
+
+    auto grid = detect(context, dest_image);
+
+    const auto& binary_image = context.binary();
+
+    auto segments = detector_kernels::detect_segments(binary_image);
+    auto segment_clusters = detector_kernels::cluster_segments(segments, binary_image);
+
+    auto intersections = detector_kernels::find_intersections(context.lines, source_image);
+    auto clusters = detector_kernels::cluster(intersections);
+    auto points = gravity_points(clusters);
+
+    //The OpenCV filters one after the other (the previous binarization)
+    //against the streaming kernel, on one thread and on all the threads
+    const auto& gray_image = context.gray();
+    const auto threads = cv::getNumThreads();
+
+    for(bool sauvola : {false, true}){
+        const std::string method = sauvola ? "sauvola" : "adaptive";
+
+        for(auto t : {1, threads}){
+            cv::setNumThreads(t);
+
+            const auto suffix = " (" + std::to_string(t) + "t)";
+
+            bench("steps " + method + suffix, repeat, [&](){
+                cv::Mat binary;
+                binarize_steps(gray_image, binary, sauvola);
+            });
+
+            bench("stream " + method + suffix, repeat, [&](){
+                cv::Mat binary;
+                stream_binarize(gray_image, binary, sauvola);
+            });
+        }
+    }
+
+    cv::setNumThreads(threads);
+
+    bench("detect_segments", repeat, [&](){
+        detector_kernels::detect_segments(binary_image);
+    });
+
+    bench("cluster_segments", repeat, [&](){
+        detector_kernels::cluster_segments(segments, binary_image);
+    });
+
+    if(!segment_clusters.empty()){
+        const auto& max_cluster = *std::max_element(segment_clusters.begin(), segment_clusters.end(),
+            [](auto& lhs, auto& rhs){return lhs.size() < rhs.size();});
+
+        //The copy of the cluster is part of the measure
+        bench("merge_segments", repeat, [&](){
+            auto merged = max_cluster;
+            detector_kernels::merge_segments(merged);
+        });
+    }
+
+    bench("find_intersections", repeat, [&](){
+        detector_kernels::find_intersections(context.lines, source_image);
+    });
+
+    bench("cluster", repeat, [&](){
+        detector_kernels::cluster(intersections);
+    });
+
+    if(!points.empty()){
+        bench("compute_hull", repeat, [&](){
+            detector_kernels::compute_hull(points);
+        });
+    }
+
+    if(context.hull.size() == 4){
+        bench("compute_grid", repeat, [&](){
+            cv::Mat grid_image = source_image.clone();
+            detector_kernels::compute_grid(context.hull, grid_image);
+        });
+    }
+
+    if(!grid.valid()){
+        std::cout << "No grid detected, skipping the cell kernels" << std::endl;
+        return;
+    }
+
+    bench("split", repeat, [&](){
+        cv::Mat split_image = source_image.clone();
+        split(context, split_image);
+    });
+
+    for(bool sauvola : {false, true}){
+        bench(std::string("cell_binarize ") + (sauvola ? "sauvola" : "adaptive") + " (81)", repeat, [&](){
+            cv::Mat binary;
+
+            for(auto& cell : grid.cells){
+                cell_binarize(cell.gray_mat(), binary, false, sauvola);
+            }
+        });
+    }
+
+    std::vector<float> image(CELL_SIZE * CELL_SIZE);
+
+    bench("mat_to_image (81)", repeat, [&](){
+        for(auto& cell : grid.cells){
+            mat_to_image(cell.binary_mat, image.data(), false);
+        }
+    });
+
+    //Only the non-empty cells are classified by the recognizer
+    std::vector<const sudoku_cell*> cells;
+
+    for(auto& cell : grid.cells){
+        if(!cell.empty()){
+            cells.push_back(&cell);
+        }
+    }
+
+    if(cells.empty()){
+        std::cout << "No digit detected, skipping the network kernels" << std::endl;
+        return;
+    }
+
+    std::vector<etl::dyn_matrix<double, 1>> inputs;
+
+    for(auto cell : cells){
+        inputs.push_back(cell->image_1d<double>(conf));
+    }
+
+    const auto suffix = " (" + std::to_string(cells.size()) + ")";
+
+    bench("dbn forward" + suffix, repeat, [&](){
+        for(auto& input : inputs){
+            dbn.activation_probabilities(input);
+        }
+    });
+
+    bench("dbn batch" + suffix, repeat, [&](){
+        batch_activation_probabilities(dbn, cells, conf);
+    });
+
+    //The batch must give the same probabilities as the forward pass of dll
+    auto weights = batch_activation_probabilities(dbn, cells, conf);
+
+    double difference = 0.0;
+    std::size_t mismatches = 0;
+
+    for(std::size_t n = 0; n < cells.size(); ++n){
+        auto sample = dbn.activation_probabilities(inputs[n]);
+
+        std::size_t label = 0;
+
+        for(std::size_t x = 0; x < 9; ++x){
+            difference = std::max(difference, std::fabs(sample(x) - weights(n, x)));
+
+            if(sample(x) > sample(label)){
+                label = x;
+            }
+        }
+
+        if(label != batch_label(weights, n)){
+            ++mismatches;
+        }
+    }
+
+    std::cout << "batch/forward max difference: " << difference << " (" << mismatches << " different labels)" << std::endl;
+}
+
+} //end of anonymous namespace
+
+int main(int argc, char** argv){
+    std::size_t repeat = default_repeat;
+    std::vector<std::string> files;
+
+    for(int i = 1; i < argc; ++i){
+        std::string arg(argv[i]);
+
+        if(arg == "-R" && i + 1 < argc){
+            repeat = std::max(1ul, std::stoul(argv[++i]));
+        } else {
+            files.push_back(arg);
+        }
+    }
+
+    std::mt19937 generator(seed);
+
+    //The weights do not change the cost of a forward pass, they are only
+    //random to avoid measuring on trivial values
+    auto dbn = std::make_unique<dbn_t>();
+    randomize_layer(dbn->layer_get<0>(), generator);
+    randomize_layer(dbn->layer_get<1>(), generator);
+    randomize_layer(dbn->layer_get<2>(), generator);
+
+    {
+        std::cout << "== solver" << std::endl;
+
+        sudoku_board board;
+        for(std::size_t k = 0; k < 81; ++k){
+            board[k] = hard_puzzle[k] - '0';
+        }
+
+        bench("solve", repeat, [&](){
+            auto copy = board;
+            solve(copy);
+        });
+
+        bench("count_solutions", repeat, [&](){
+            count_solutions(board);
+        });
+    }
+
+    {
+        std::cout << "== line extension (1000 segments)" << std::endl;
+
+        const cv::Size size(800, 600);
+
+        std::uniform_real_distribution<float> x_dist(1.0f, size.width - 1.0f);
+        std::uniform_real_distribution<float> y_dist(1.0f, size.height - 1.0f);
+
+        std::vector<std::pair<cv::Point2f, cv::Point2f>> segments;
+        while(segments.size() < 1000){
+            cv::Point2f a(x_dist(generator), y_dist(generator));
+            cv::Point2f b(x_dist(generator), y_dist(generator));
+
+            if(a != b){
+                segments.emplace_back(a, b);
+            }
+        }
+
+        bench("extend_line_stepping", repeat, [&](){
+            for(auto& segment : segments){
+                extend_line_stepping(segment.first, segment.second, size);
+            }
+        });
+
+        bench("extend_line", repeat, [&](){
+            for(auto& segment : segments){
+                extend_line(segment.first, segment.second, size);
+            }
+        });
+    }
+
+    bench_image("synthetic", synthetic_grid(generator), *dbn, repeat);
+
+    for(auto& file : files){
+        auto image = open_image(file);
+
+        if(!image.data){
+            std::cerr << "Invalid source_image " << file << ", skipped" << std::endl;
+            continue;
+        }
+
+        bench_image(file, image, *dbn, repeat);
+    }
+
+    return 0;
+}
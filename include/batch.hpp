@@ -0,0 +1,237 @@
+//=======================================================================
+// Copyright Baptiste Wicht 2013-2015.
+// Distributed under the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#ifndef SUDOKU_BATCH_HPP
+#define SUDOKU_BATCH_HPP
+
+//Batched classification of cells: all the cells of a batch are packed
+//into one matrix (one cell per row) and go through the network at once
+
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+
+//Defines DLL_SVM_SUPPORT, must come before the other DLL headers
+#include "networks.hpp"
+
+#include "config.hpp"
+#include "sudoku.hpp"
+
+using batch_t = etl::dyn_matrix<double, 2>;
+
+template<typename T>
+etl::dyn_matrix<T, 2> cell_batch(const std::vector<const sudoku_cell*>& cells, const config& conf){
+    const auto& first = cells.front()->mat(conf);
+    const std::size_t size = first.rows * first.cols;
+
+    etl::dyn_matrix<T, 2> batch(cells.size(), size);
+
+    for(std::size_t n = 0; n < cells.size(); ++n){
+        cells[n]->image_to(batch.memory_start() + n * size, conf);
+    }
+
+    return batch;
+}
+
+//Activation probabilities of the hidden units of a layer, computed in
+//place from the input of the units (without the biases)
+template<dll::unit_type Hidden>
+struct batch_hidden_activation;
+
+template<>
+struct batch_hidden_activation<dll::unit_type::BINARY> {
+    template<typename M, typename C>
+    static void apply(M& output, const C& c, std::size_t n, std::size_t m){
+        for(std::size_t i = 0; i < n; ++i){
+            for(std::size_t j = 0; j < m; ++j){
+                output(i, j) = 1.0 / (1.0 + std::exp(-(output(i, j) + c(j))));
+            }
+        }
+    }
+};
+
+template<>
+struct batch_hidden_activation<dll::unit_type::SOFTMAX> {
+    template<typename M, typename C>
+    static void apply(M& output, const C& c, std::size_t n, std::size_t m){
+        for(std::size_t i = 0; i < n; ++i){
+            auto max = output(i, 0) + c(0);
+            for(std::size_t j = 1; j < m; ++j){
+                max = std::max(max, output(i, j) + c(j));
+            }
+
+            decltype(max) sum = 0.0;
+            for(std::size_t j = 0; j < m; ++j){
+                output(i, j) = std::exp(output(i, j) + c(j) - max);
+                sum += output(i, j);
+            }
+
+            for(std::size_t j = 0; j < m; ++j){
+                output(i, j) /= sum;
+            }
+        }
+    }
+};
+
+template<>
+struct batch_hidden_activation<dll::unit_type::EXP> {
+    template<typename M, typename C>
+    static void apply(M& output, const C& c, std::size_t n, std::size_t m){
+        for(std::size_t i = 0; i < n; ++i){
+            for(std::size_t j = 0; j < m; ++j){
+                output(i, j) = std::exp(output(i, j) + c(j));
+            }
+        }
+    }
+};
+
+//RELU, RELU1 and RELU6 only differ by their upper bound
+template<typename M, typename C>
+void batch_relu_activation(M& output, const C& c, std::size_t n, std::size_t m, double bound){
+    for(std::size_t i = 0; i < n; ++i){
+        for(std::size_t j = 0; j < m; ++j){
+            auto x = output(i, j) + c(j);
+            output(i, j) = x < 0.0 ? 0.0 : (x > bound ? bound : x);
+        }
+    }
+}
+
+template<>
+struct batch_hidden_activation<dll::unit_type::RELU> {
+    template<typename M, typename C>
+    static void apply(M& output, const C& c, std::size_t n, std::size_t m){
+        batch_relu_activation(output, c, n, m, std::numeric_limits<double>::infinity());
+    }
+};
+
+template<>
+struct batch_hidden_activation<dll::unit_type::RELU1> {
+    template<typename M, typename C>
+    static void apply(M& output, const C& c, std::size_t n, std::size_t m){
+        batch_relu_activation(output, c, n, m, 1.0);
+    }
+};
+
+template<>
+struct batch_hidden_activation<dll::unit_type::RELU6> {
+    template<typename M, typename C>
+    static void apply(M& output, const C& c, std::size_t n, std::size_t m){
+        batch_relu_activation(output, c, n, m, 6.0);
+    }
+};
+
+//The batch in the weight type W, without a copy if it is already of this type
+template<typename W>
+const etl::dyn_matrix<W, 2>& batch_as(const etl::dyn_matrix<W, 2>& input){
+    return input;
+}
+
+template<typename W, typename T, std::enable_if_t<!std::is_same<W, T>::value, int> = 0>
+etl::dyn_matrix<W, 2> batch_as(const etl::dyn_matrix<T, 2>& input){
+    etl::dyn_matrix<W, 2> output(etl::dim<0>(input), etl::dim<1>(input));
+    std::copy(input.memory_start(), input.memory_end(), output.memory_start());
+    return output;
+}
+
+//Activation probabilities of a whole RBM layer for a batch of n
+//samples, the weights are applied with a single matrix-matrix
+//multiplication, in the weight type of the layer
+template<typename RBM, typename T>
+etl::dyn_matrix<typename RBM::weight, 2> batch_activate(const RBM& rbm, const etl::dyn_matrix<T, 2>& input, std::size_t n){
+    using weight = typename RBM::weight;
+
+    decltype(auto) visible = batch_as<weight>(input);
+
+    etl::dyn_matrix<weight, 2> output(n, RBM::num_hidden);
+
+    output = etl::mul(visible, rbm.w);
+
+    batch_hidden_activation<RBM::hidden_unit>::apply(output, rbm.c, n, RBM::num_hidden);
+
+    return output;
+}
+
+//A layer is dense when it is a plain RBM, the convolutional and pooling
+//layers have no num_hidden
+template<typename Layer, typename Enable = void>
+struct is_dense_layer : std::false_type {};
+
+template<typename Layer>
+struct is_dense_layer<Layer, decltype(void(Layer::num_hidden))> : std::true_type {};
+
+template<typename DBN, std::size_t I = 0, bool End = I == DBN::layers>
+struct is_dense_network : std::integral_constant<bool,
+    is_dense_layer<typename DBN::template layer_type<I>>::value && is_dense_network<DBN, I + 1>::value> {};
+
+template<typename DBN, std::size_t I>
+struct is_dense_network<DBN, I, true> : std::true_type {};
+
+//Value type of the weights of the first layer of a network
+template<typename Net>
+using input_weight_t = typename Net::template layer_type<0>::weight;
+
+//Forward pass of the batch through the layers [I, layers) of a dense network
+template<typename DBN, std::size_t I = 0, bool Last = I == DBN::layers - 1>
+struct dense_batch_forward {
+    template<typename T>
+    static batch_t apply(DBN& dbn, const etl::dyn_matrix<T, 2>& input, std::size_t n){
+        auto output = batch_activate(dbn.template layer_get<I>(), input, n);
+        return dense_batch_forward<DBN, I + 1>::apply(dbn, output, n);
+    }
+};
+
+template<typename DBN, std::size_t I>
+struct dense_batch_forward<DBN, I, true> {
+    template<typename T>
+    static batch_t apply(DBN& dbn, const etl::dyn_matrix<T, 2>& input, std::size_t n){
+        static_assert(DBN::template layer_type<I>::num_hidden == 9, "The last layer must have one unit per digit");
+
+        auto output = batch_activate(dbn.template layer_get<I>(), input, n);
+
+        return batch_as<double>(output);
+    }
+};
+
+//Dense networks are computed layer by layer on the complete batch
+template<typename Net, std::enable_if_t<is_dense_network<Net>::value, int> = 0>
+batch_t batch_activation_probabilities(Net& dbn, const std::vector<const sudoku_cell*>& cells, const config& conf){
+    auto input = cell_batch<input_weight_t<Net>>(cells, conf);
+    return dense_batch_forward<Net>::apply(dbn, input, cells.size());
+}
+
+//The convolutional networks have no batched forward pass, their cells
+//go through the network one at a time
+template<typename Net, std::enable_if_t<!is_dense_network<Net>::value, int> = 0>
+batch_t batch_activation_probabilities(Net& dbn, const std::vector<const sudoku_cell*>& cells, const config& conf){
+    batch_t output(cells.size(), 9);
+
+    for(std::size_t n = 0; n < cells.size(); ++n){
+        auto weights = dbn.activation_probabilities(cells[n]->template image_1d<input_weight_t<Net>>(conf));
+
+        for(std::size_t x = 0; x < 9; ++x){
+            output(n, x) = weights(x);
+        }
+    }
+
+    return output;
+}
+
+inline std::size_t batch_label(const batch_t& weights, std::size_t n){
+    std::size_t label = 0;
+
+    for(std::size_t x = 1; x < 9; ++x){
+        if(weights(n, x) > weights(n, label)){
+            label = x;
+        }
+    }
+
+    return label;
+}
+
+#endif
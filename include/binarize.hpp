@@ -0,0 +1,26 @@
+//=======================================================================
+// Copyright Baptiste Wicht 2013-2015.
+// Distributed under the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#ifndef SUDOKU_BINARIZE_HPP
+#define SUDOKU_BINARIZE_HPP
+
+#include <opencv2/opencv.hpp>
+
+//Binarization of the gray source image with the OpenCV filters applied
+//one after the other on the full image: median blur (5x5), threshold
+//(adaptive mean 11x11 or Sauvola 23x23), median blur (5x5) and
+//dilation (3x3 cross)
+void binarize_steps(const cv::Mat& gray_image, cv::Mat& dest_image, bool sauvola);
+
+//Same binarization (bit for bit) in a single pass over the rows: each row
+//of each step is computed as soon as the rows it depends on are ready and
+//only the last rows of each step are kept. Each thread streams its own
+//range of rows, only the rows of the borders of the ranges are computed
+//twice. dest_image must not be gray_image.
+void stream_binarize(const cv::Mat& gray_image, cv::Mat& dest_image, bool sauvola);
+
+#endif
@@ -0,0 +1,34 @@
+//=======================================================================
+// Copyright Baptiste Wicht 2013-2015.
+// Distributed under the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#ifndef SUDOKU_CELL_CACHE_HPP
+#define SUDOKU_CELL_CACHE_HPP
+
+#include <string>
+
+#include "config.hpp"
+#include "data.hpp"
+#include "sudoku.hpp"
+
+//The cells detected in an image are cached in a binary file next to the
+//image (image path + ".cells") or in the cache directory of the
+//configuration (image path with the '/' replaced by '%' + ".cells").
+//The cache stores the ground truth, the state and the boxes of the cells
+//and their binary planes. It is only valid for the same image and ground
+//truth files (modification time and size), the same detector settings,
+//the same DETECTOR_VERSION and the same OpenCV version. The grids loaded
+//from the cache have no source image, only their binary planes can be
+//used. The planes are not copied, the grid keeps the mapping of the file
+//alive.
+
+//Load the cached grid of the image, returns false if there is no valid cache
+bool load_cell_cache(const std::string& image_path, const config& conf, sudoku_grid& grid, gt_data& data);
+
+//Save the grid detected in the image in its cache
+void save_cell_cache(const std::string& image_path, const config& conf, const sudoku_grid& grid, const gt_data& data);
+
+#endif
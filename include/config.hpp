@@ -10,6 +10,7 @@
 
 #include <vector>
 #include <string>
+#include <cstdint>
 
 struct config {
     std::vector<std::string> args;
@@ -24,6 +25,18 @@ struct config {
     bool oracle  = false;
     bool shuffle = false;
     bool conv    = false;
+    bool sauvola = false;
+    bool cache   = false;
+    bool unique  = false;
+    bool rectify = false;
+
+    std::size_t threads = 1; //Number of worker threads
+    std::uint64_t seed  = 0; //Master seed of the generation (0 for a random seed)
+
+    std::size_t warmup = 1;  //Number of untimed runs before the measures (time)
+    std::size_t repeat = 1;  //Number of timed runs (time)
+    std::string format = "text"; //Output format of the measures, text, csv or json (time)
+    std::string cache_dir;   //Directory of the cell cache (empty for next to the images)
 
     bool gray = false; //This is computed at compile-time
     bool big  = false; //This is computed at compile-time
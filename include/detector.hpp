@@ -9,27 +9,73 @@
 #define SUDOKU_SUDOKU_HPP
 
 #include<vector>
+#include <cstdint>
 
 #include <opencv2/opencv.hpp>
 
 #include "sudoku.hpp"
 
+//Version of the detection, it is part of the key of the cell cache. It
+//must be incremented by every change of the decoding or of the detection
+//that changes the detected cells, the caches of the previous versions
+//are then ignored
+constexpr const uint32_t DETECTOR_VERSION = 2;
+
 constexpr const size_t CELL_SIZE = 32;
 constexpr const size_t BIG_CELL_SIZE = 48;
 
 typedef std::pair<cv::Point2f, cv::Point2f> line_t;
 typedef std::pair<cv::Point2f, cv::Point2f> grid_cell;
 
-void sudoku_binarize(const cv::Mat& source_image, cv::Mat& dest_image);
-void cell_binarize(const cv::Mat& gray_image, cv::Mat& dest_image, bool mixed);
+//Intermediate products of the detection of one image, each of them is
+//computed at most once and shared between the detection steps
+struct detection_context {
+    cv::Mat source_image;       //The source image (color or already binary)
+    cv::Mat gray_image;         //The gray version of the source image
+    cv::Mat binary_image;       //The binarized source image
+    cv::Mat edges_image;        //The edges of the binary image (contour hull)
+
+    std::vector<line_t> lines;
+    std::vector<cv::Point2f> hull;
+    std::vector<cv::Rect> cells;
+
+    cv::Mat rectify_transform;  //Homography from the source image to the rectified image (-w)
+
+    bool mixed;
+    bool sauvola;               //Sauvola threshold instead of the adaptive mean one (-b)
+    bool rectify = false;       //Warp the grid into a square image before splitting it
+
+    explicit detection_context(const cv::Mat& source_image, bool mixed = false, bool sauvola = false) : source_image(source_image), mixed(mixed), sauvola(sauvola) {}
+
+    detection_context(const cv::Mat& source_image, const config& conf) : source_image(source_image), mixed(conf.mixed), sauvola(conf.sauvola), rectify(conf.rectify) {}
+
+    const cv::Mat& gray();
+    const cv::Mat& binary();
+    const cv::Mat& edges();
+};
+
+//The binarizations use the Sauvola threshold when sauvola is set and the
+//adaptive mean threshold otherwise
+void sudoku_binarize(const cv::Mat& source_image, cv::Mat& dest_image, bool sauvola);
+void sudoku_binarize_gray(const cv::Mat& gray_image, cv::Mat& dest_image, bool sauvola);
+void cell_binarize(const cv::Mat& gray_image, cv::Mat& dest_image, bool mixed, bool sauvola);
+
+//Extend the segment [a,b] to the borders of an image of the given size
+line_t extend_line(const cv::Point2f& a, const cv::Point2f& b, const cv::Size& size);
+line_t extend_line_stepping(cv::Point2f a, cv::Point2f b, const cv::Size& size);
 
 std::vector<line_t> detect_lines(const cv::Mat& source_image, cv::Mat& dest_image, bool mixed = false);
 std::vector<line_t> detect_lines_binary(const cv::Mat& source_image, cv::Mat& dest_image, bool mixed = false);
 std::vector<cv::Rect> detect_grid(const cv::Mat& source_image, cv::Mat& dest_image, std::vector<line_t>& lines, bool mixed = false);
 sudoku_grid split(const cv::Mat& source_image, cv::Mat& dest_image, const std::vector<cv::Rect>& cells, std::vector<line_t>& lines, bool mixed = false);
 
-sudoku_grid detect(const cv::Mat& source_image, cv::Mat& dest_image, bool mixed = false);
-sudoku_grid detect_binary(const cv::Mat& source_image, cv::Mat& dest_image, bool mixed = false);
+std::vector<line_t>& detect_lines(detection_context& context, cv::Mat& dest_image);
+std::vector<cv::Rect>& detect_grid(detection_context& context, cv::Mat& dest_image);
+sudoku_grid split(detection_context& context, cv::Mat& dest_image);
+
+sudoku_grid detect(const cv::Mat& source_image, cv::Mat& dest_image, bool mixed = false, bool sauvola = false);
+sudoku_grid detect(detection_context& context, cv::Mat& dest_image);
+sudoku_grid detect_binary(const cv::Mat& source_image, cv::Mat& dest_image, bool mixed = false, bool sauvola = false);
 
 void show_regrid(sudoku_grid& grid, int mode);
 
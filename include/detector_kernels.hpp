@@ -0,0 +1,31 @@
+//=======================================================================
+// Copyright Baptiste Wicht 2013-2015.
+// Distributed under the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#ifndef SUDOKU_DETECTOR_KERNELS_HPP
+#define SUDOKU_DETECTOR_KERNELS_HPP
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "detector.hpp"
+
+//Internal steps of the detection, only exposed to benchmark them in isolation
+namespace detector_kernels {
+
+std::vector<cv::Vec4i> detect_segments(const cv::Mat& binary_image);
+std::vector<std::vector<cv::Vec4i>> cluster_segments(const std::vector<cv::Vec4i>& segments, const cv::Mat& image);
+void merge_segments(std::vector<cv::Vec4i>& segments);
+
+std::vector<cv::Point2f> find_intersections(const std::vector<line_t>& lines, const cv::Mat& image);
+std::vector<std::vector<cv::Point2f>> cluster(const std::vector<cv::Point2f>& intersections);
+std::vector<cv::Point2f> compute_hull(const std::vector<cv::Point2f>& points);
+std::vector<cv::Rect> compute_grid(const std::vector<cv::Point2f>& hull, cv::Mat& dest_image);
+
+} //end of namespace detector_kernels
+
+#endif
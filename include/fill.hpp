@@ -9,16 +9,45 @@
 #define SUDOKU_FILL_HPP
 
 #include <vector>
+#include <array>
+#include <random>
+#include <ostream>
+
+#include <opencv2/opencv.hpp>
 
 #include "mnist/mnist_reader.hpp"
 
-//These constants need to be sync when changing MNIST dataset and the fill colors
-constexpr const std::size_t mnist_size_1 = 60000;
-constexpr const std::size_t mnist_size_2 = 10000;
+//This constant needs to be sync when changing the fill colors
 constexpr const std::size_t n_colors = 6;
 
 using mnist_dataset_t = decltype(mnist::read_dataset<std::vector, std::vector, uint8_t, uint8_t>());
 
-cv::Mat fill_image(const std::string& source, mnist_dataset_t& mnist_dataset, const std::vector<cv::Vec3b>& colors, bool write);
+//All the MNIST digits (training and test) in one contiguous buffer,
+//grouped by label, so that a random digit of a given label can be
+//picked directly
+struct mnist_store {
+    static constexpr const std::size_t glyph_size = 28;
+
+    std::vector<uint8_t> pixels;            //The glyphs, label after label
+    std::array<std::size_t, 11> offsets;    //Index of the first glyph of each label
+
+    explicit mnist_store(const mnist_dataset_t& dataset);
+
+    //Number of glyphs of the given label
+    std::size_t size(std::size_t label) const {
+        return offsets[label + 1] - offsets[label];
+    }
+
+    //Header over the pixels of the i-th glyph of the label (no copy)
+    cv::Mat glyph(std::size_t label, std::size_t i) const {
+        auto* data = pixels.data() + (offsets[label] + i) * glyph_size * glyph_size;
+        return cv::Mat(glyph_size, glyph_size, CV_8U, const_cast<uint8_t*>(data));
+    }
+};
+
+//Random engine of the generation, one per image
+using fill_engine_t = std::mt19937;
+
+cv::Mat fill_image(const std::string& source, const mnist_store& store, const std::vector<cv::Vec3b>& colors, bool write, bool sauvola, fill_engine_t& rand_engine, std::ostream& out);
 
 #endif
@@ -17,6 +17,11 @@ float fill_factor(const cv::Mat& mat);
 
 std::vector<double> mat_to_image(const cv::Mat& mat, bool gray = true);
 
+//Write the pixels of mat directly in the given buffer (rows * cols values)
+void mat_to_image(const cv::Mat& mat, float* image, bool gray = true);
+void mat_to_image(const cv::Mat& mat, double* image, bool gray = true);
+
 cv::Mat open_image(const std::string& path, bool resize = true);
+cv::Mat decode_image(const std::vector<uint8_t>& buffer, bool resize = true);
 
 #endif
@@ -0,0 +1,216 @@
+//=======================================================================
+// Copyright Baptiste Wicht 2013-2015.
+// Distributed under the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#ifndef SUDOKU_NETWORKS_HPP
+#define SUDOKU_NETWORKS_HPP
+
+#define DLL_SVM_SUPPORT
+
+#include "dll/rbm.hpp"
+#include "dll/conv_rbm.hpp"
+#include "dll/conv_rbm_mp.hpp"
+#include "dll/mp_layer.hpp"
+#include "dll/dbn.hpp"
+#include "dll/trainer/stochastic_gradient_descent.hpp"
+
+#include "detector.hpp"
+
+using mixed_dbn_pmp_t = dll::dbn_desc<
+    dll::dbn_layers<
+        dll::conv_rbm_mp_desc_square<1, CELL_SIZE, 30, 22, 2,
+            dll::weight_type<double>,
+            dll::momentum,
+            dll::weight_decay<dll::decay_type::L2>,
+            //dll::visible<dll::unit_type::GAUSSIAN>,
+            dll::sparsity<dll::sparsity_method::LEE>,
+            dll::batch_size<25>
+        >::layer_t,
+        dll::conv_rbm_mp_desc_square<30, 11, 30, 6, 2,
+            dll::weight_type<double>,
+            dll::momentum,
+            dll::weight_decay<dll::decay_type::L2>,
+            dll::sparsity<dll::sparsity_method::LEE>,
+            dll::batch_size<25>>::layer_t/*,
+        dll::conv_rbm_desc<10, 20, 6, 50, dll::momentum, dll::batch_size<25>>::layer_t*/
+    >, dll::batch_size<64>, /*dll::watcher<dll::opencv_dbn_visualizer>, */dll::svm_concatenate/*, dll::svm_scale*/>::dbn_t;
+
+using mixed_dbn_pmp_big_t = dll::dbn_desc<
+    dll::dbn_layers<
+        dll::conv_rbm_mp_desc_square<1, BIG_CELL_SIZE, 40, 32, 2,
+            dll::weight_type<double>,
+            dll::momentum,
+            dll::weight_decay<dll::decay_type::L2>,
+            //dll::visible<dll::unit_type::GAUSSIAN>,
+            dll::sparsity<dll::sparsity_method::LEE>,
+            dll::batch_size<25>
+        >::layer_t,
+        dll::conv_rbm_mp_desc_square<40, 16, 40, 10, 2,
+            dll::weight_type<double>,
+            dll::momentum,
+            dll::weight_decay<dll::decay_type::L2>,
+            dll::sparsity<dll::sparsity_method::LEE>,
+            dll::batch_size<25>>::layer_t/*,
+        dll::conv_rbm_desc<10, 20, 6, 50, dll::momentum, dll::batch_size<25>>::layer_t*/
+    >, dll::batch_size<64>, dll::svm_concatenate/*, dll::svm_scale*/>::dbn_t;
+
+using mixed_dbn_t = mixed_dbn_pmp_t;
+
+using dbn_t =
+    dll::dbn_desc<
+        dll::dbn_layers<
+            dll::rbm_desc<CELL_SIZE * CELL_SIZE, 500,
+                dll::momentum,
+                dll::shuffle,
+                dll::batch_size<32>,
+                dll::weight_decay<dll::decay_type::L2>,
+                dll::init_weights
+            >::layer_t,
+            dll::rbm_desc<500, 1000,
+                dll::momentum,
+                dll::shuffle,
+                dll::batch_size<32>,
+                dll::weight_decay<dll::decay_type::L2>
+            >::layer_t,
+            dll::rbm_desc<1000, 9,
+                dll::momentum,
+                dll::shuffle,
+                dll::batch_size<32>,
+                dll::weight_decay<dll::decay_type::L2>,
+                dll::hidden<dll::unit_type::SOFTMAX>
+            >::layer_t
+        >,
+        dll::trainer<dll::sgd_trainer>,
+        dll::batch_size<32>,
+        dll::momentum,
+        dll::shuffle,
+        //dll::verbose,
+        dll::weight_decay<dll::decay_type::L2>
+    >::dbn_t;
+
+using dbn_mixed_t =
+    dll::dbn_desc<
+        dll::dbn_layers<
+            dll::rbm_desc<CELL_SIZE * CELL_SIZE, 300,
+                dll::momentum,
+                dll::shuffle,
+                dll::batch_size<32>,
+                dll::weight_decay<dll::decay_type::L2>,
+                dll::hidden<dll::unit_type::BINARY>,
+                dll::init_weights
+            >::layer_t,
+            dll::rbm_desc<300, 300,
+                dll::momentum,
+                dll::shuffle,
+                dll::batch_size<32>,
+                dll::weight_decay<dll::decay_type::L2>,
+                dll::hidden<dll::unit_type::BINARY>
+            >::layer_t,
+            dll::rbm_desc<300, 9,
+                dll::momentum,
+                dll::shuffle,
+                dll::batch_size<32>,
+                dll::weight_decay<dll::decay_type::L2>,
+                dll::hidden<dll::unit_type::SOFTMAX>
+            >::layer_t
+        >,
+        dll::trainer<dll::sgd_trainer>,
+        dll::batch_size<32>,
+        dll::momentum,
+        dll::shuffle,
+        //dll::verbose,
+        dll::weight_decay<dll::decay_type::L2>
+    >::dbn_t;
+
+using cdbn_t =
+    dll::dbn_desc<
+        dll::dbn_layers<
+            dll::conv_rbm_desc<1, CELL_SIZE, CELL_SIZE, 4, 28, 28,
+                dll::weight_type<float>,
+                dll::momentum,
+                dll::shuffle,
+                dll::weight_decay<dll::decay_type::L2>,
+                dll::batch_size<32>,
+                dll::hidden<dll::unit_type::BINARY>
+            >::layer_t,
+            dll::mp_layer_3d_desc<4, 28, 28, 1, 2, 2, dll::weight_type<float>>::layer_t,
+            dll::conv_rbm_desc<4, 14, 14, 6, 10, 10,
+                dll::weight_type<float>,
+                dll::momentum,
+                dll::shuffle,
+                dll::weight_decay<dll::decay_type::L2>,
+                dll::batch_size<32>,
+                dll::hidden<dll::unit_type::BINARY>
+            >::layer_t,
+            dll::mp_layer_3d_desc<6, 10, 10, 1, 2, 2, dll::weight_type<float>>::layer_t,
+            dll::rbm_desc<6 * 5 * 5, 120,
+                dll::momentum,
+                dll::shuffle,
+                dll::weight_decay<dll::decay_type::L2>,
+                dll::batch_size<32>,
+                dll::hidden<dll::unit_type::BINARY>
+            >::layer_t,
+            dll::rbm_desc<120, 9,
+                dll::momentum,
+                dll::shuffle,
+                dll::batch_size<32>,
+                dll::weight_decay<dll::decay_type::L2>,
+                dll::hidden<dll::unit_type::SOFTMAX>
+            >::layer_t
+        >,
+        dll::trainer<dll::sgd_trainer>,
+        dll::batch_size<32>,
+        dll::momentum,
+        dll::shuffle,
+        dll::verbose,
+        dll::weight_decay<dll::decay_type::L2>
+    >::dbn_t;
+
+using cdbn_mixed_t =
+    dll::dbn_desc<
+        dll::dbn_layers<
+            dll::conv_rbm_desc<1, CELL_SIZE, CELL_SIZE, 6, 28, 28,
+                dll::weight_type<float>,
+                dll::momentum,
+                dll::shuffle,
+                dll::weight_decay<dll::decay_type::L2>,
+                dll::batch_size<32>,
+                dll::hidden<dll::unit_type::BINARY>
+            >::layer_t,
+            dll::mp_layer_3d_desc<6, 28, 28, 1, 2, 2, dll::weight_type<float>>::layer_t,
+            dll::conv_rbm_desc<6, 14, 14, 6, 10, 10,
+                dll::weight_type<float>,
+                dll::momentum,
+                dll::shuffle,
+                dll::weight_decay<dll::decay_type::L2>,
+                dll::batch_size<32>,
+                dll::hidden<dll::unit_type::BINARY>
+            >::layer_t,
+            dll::mp_layer_3d_desc<6, 10, 10, 1, 2, 2, dll::weight_type<float>>::layer_t,
+            dll::rbm_desc<6 * 5 * 5, 100,
+                dll::momentum,
+                dll::shuffle,
+                dll::weight_decay<dll::decay_type::L2>,
+                dll::batch_size<32>,
+                dll::hidden<dll::unit_type::BINARY>
+            >::layer_t,
+            dll::rbm_desc<100, 9,
+                dll::momentum,
+                dll::shuffle,
+                dll::batch_size<32>,
+                dll::weight_decay<dll::decay_type::L2>,
+                dll::hidden<dll::unit_type::SOFTMAX>
+            >::layer_t
+        >,
+        dll::trainer<dll::sgd_trainer>,
+        dll::batch_size<32>,
+        dll::momentum,
+        dll::shuffle,
+        dll::verbose,
+        dll::weight_decay<dll::decay_type::L2>
+    >::dbn_t;
+
+#endif
@@ -0,0 +1,171 @@
+//=======================================================================
+// Copyright Baptiste Wicht 2013-2015.
+// Distributed under the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#ifndef SUDOKU_PIPELINE_HPP
+#define SUDOKU_PIPELINE_HPP
+
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <utility>
+#include <exception>
+#include <condition_variable>
+
+//Run work(input) for each input given by produce(input), until it
+//returns false, on a pool of threads and give the results to
+//consume(i, result) on the calling thread, in input order. produce is
+//called under a lock, in order, and only when a result can be waited
+//for: at most 2 * threads results are waiting to be consumed, the
+//workers are blocked while the consumer is late. With threads <= 1,
+//everything is done on the calling thread. If produce, work or consume
+//throws, no more input is produced, all the threads are joined and the
+//first exception is rethrown on the calling thread.
+template<typename Input, typename Produce, typename Work, typename Consume>
+void ordered_stream_pipeline(std::size_t threads, Produce&& produce, Work&& work, Consume&& consume){
+    using result_t = decltype(work(std::declval<Input&>()));
+
+    if(threads <= 1){
+        Input input;
+
+        for(std::size_t i = 0; produce(input); ++i){
+            auto result = work(input);
+            consume(i, result);
+        }
+
+        return;
+    }
+
+    const std::size_t window = 2 * threads;
+
+    std::mutex lock;
+    std::condition_variable cond;
+
+    std::map<std::size_t, result_t> done;
+    std::size_t next     = 0;
+    std::size_t consumed = 0;
+    bool exhausted       = false;
+
+    std::exception_ptr error;
+
+    //Keep the first error and stop producing inputs
+    auto fail = [&](std::exception_ptr e){
+        {
+            std::lock_guard<std::mutex> l(lock);
+
+            if(!error){
+                error = e;
+            }
+
+            exhausted = true;
+        }
+
+        cond.notify_all();
+    };
+
+    std::vector<std::thread> pool;
+    pool.reserve(threads);
+
+    try {
+        for(std::size_t t = 0; t < threads; ++t){
+            pool.emplace_back([&](){
+                while(true){
+                    std::size_t i;
+                    Input input;
+
+                    try {
+                        std::unique_lock<std::mutex> l(lock);
+                        cond.wait(l, [&](){ return exhausted || next < consumed + window; });
+
+                        if(exhausted){
+                            return;
+                        }
+
+                        if(!produce(input)){
+                            exhausted = true;
+                            l.unlock();
+                            cond.notify_all();
+                            return;
+                        }
+
+                        i = next++;
+                    } catch(...){
+                        fail(std::current_exception());
+                        return;
+                    }
+
+                    try {
+                        auto result = work(input);
+
+                        std::lock_guard<std::mutex> l(lock);
+                        done.emplace(i, std::move(result));
+                    } catch(...){
+                        fail(std::current_exception());
+                        return;
+                    }
+
+                    cond.notify_all();
+                }
+            });
+        }
+
+        while(true){
+            result_t result;
+
+            {
+                std::unique_lock<std::mutex> l(lock);
+                cond.wait(l, [&](){ return error || done.count(consumed) > 0 || (exhausted && consumed == next); });
+
+                if(error || !done.count(consumed)){
+                    break;
+                }
+
+                auto it = done.find(consumed);
+                result = std::move(it->second);
+                done.erase(it);
+            }
+
+            consume(consumed, result);
+
+            {
+                std::lock_guard<std::mutex> l(lock);
+                ++consumed;
+            }
+
+            cond.notify_all();
+        }
+    } catch(...){
+        fail(std::current_exception());
+    }
+
+    for(auto& thread : pool){
+        thread.join();
+    }
+
+    if(error){
+        std::rethrow_exception(error);
+    }
+}
+
+//Run work(i) for each i in [0, n), see ordered_stream_pipeline. There
+//is a single parallel stage: the decoding and the detection of an image
+//are done by the same work(i), the classification of the grids of test
+//is a second pipeline run once the dataset is loaded
+template<typename Work, typename Consume>
+void ordered_pipeline(std::size_t n, std::size_t threads, Work&& work, Consume&& consume){
+    std::size_t next = 0;
+
+    ordered_stream_pipeline<std::size_t>(threads,
+        [&next, n](std::size_t& i){
+            i = next++;
+            return i < n;
+        },
+        [&work](std::size_t& i){ return work(i); },
+        std::forward<Consume>(consume));
+}
+
+#endif
@@ -0,0 +1,30 @@
+//=======================================================================
+// Copyright Baptiste Wicht 2013-2015.
+// Distributed under the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#ifndef SUDOKU_SAUVOLA_HPP
+#define SUDOKU_SAUVOLA_HPP
+
+#include <cmath>
+#include <algorithm>
+
+#include <opencv2/opencv.hpp>
+
+//Sauvola binarization of a gray image: a pixel is set to 255 if it is
+//brighter than m * (1 + k * (s / R - 1)) where m and s are the mean and
+//the standard deviation of the window around the pixel, 0 otherwise
+//(same polarity as the adaptiveThreshold binarization).
+void sauvola_binarize(const cv::Mat& gray_image, cv::Mat& dest_image, int window, double k = 0.2, double R = 128.0);
+
+//Sauvola threshold of a window from the sum (s) and the sum of the
+//squares (q) of its values
+inline double sauvola_threshold(double s, double q, double area, double k, double R){
+    auto mean = s / area;
+    auto deviation = std::sqrt(std::max(q / area - mean * mean, 0.0));
+    return mean * (1.0 + k * (deviation / R - 1.0));
+}
+
+#endif
@@ -8,10 +8,25 @@
 #ifndef SUDOKU_SOLVER_HPP
 #define SUDOKU_SOLVER_HPP
 
+#include <array>
+#include <cstdint>
+#include <random>
+
 #include "detector.hpp"
 
+//Compact sudoku: the values of the 81 cells, row after row (0 for empty)
+using sudoku_board = std::array<uint8_t, 81>;
+
+bool solve(sudoku_board& board);
 bool solve(sudoku_grid& grid);
+
+//Count the solutions of the board, stopping at limit (e.g. 2 to know if
+//there is no solution, exactly one or many)
+std::size_t count_solutions(const sudoku_board& board, std::size_t limit = 2);
+
+//Check that no digit appears twice in a row, column or box
+bool is_valid(const sudoku_board& board);
 bool is_valid(sudoku_grid& grid);
-void solve_random(sudoku_grid& grid);
+void solve_random(sudoku_grid& grid, std::mt19937& rand_engine);
 
 #endif
@@ -9,6 +9,7 @@
 #define SUDOKU_DETECTOR_HPP
 
 #include<vector>
+#include <memory>
 
 #include <opencv2/opencv.hpp>
 
@@ -19,19 +20,30 @@
 
 struct sudoku_cell {
     bool m_empty = true;
+    bool m_digit = false;       //Indicates if digit_bounding has been found
 
     cv::Mat binary_mat;  //Binary final cv::Mat
-    cv::Mat gray_mat;    //Gray final cv::Mat
-    cv::Mat color_mat;   //RGB final cv::Mat
+
+    cv::Mat source_image; //The color source image, the other planes are extracted from it on demand
 
     cv::Rect bounding;
     cv::Rect digit_bounding;
     uint8_t m_value = 0;
     uint8_t m_correct = 0;      //This is the value coming from the ground truth in [0,9]
+    bool m_sauvola = false;     //Threshold of the binarization of the detection (bounding_binary_mat)
+
+    //Lazily computed planes (see the accessors), not thread-safe
+    mutable cv::Mat m_gray_mat;
+    mutable cv::Mat m_color_mat;
+    mutable cv::Mat m_bounding_binary_mat;
+    mutable cv::Mat m_bounding_gray_mat;
+    mutable cv::Mat m_bounding_color_mat;
 
-    cv::Mat bounding_binary_mat;  //Binary final cv::Mat
-    cv::Mat bounding_gray_mat;    //Gray final cv::Mat
-    cv::Mat bounding_color_mat;   //RGB final cv::Mat
+    const cv::Mat& gray_mat() const;             //Gray final cv::Mat
+    const cv::Mat& color_mat() const;            //RGB final cv::Mat
+    const cv::Mat& bounding_binary_mat() const;  //Binary final cv::Mat
+    const cv::Mat& bounding_gray_mat() const;    //Gray final cv::Mat
+    const cv::Mat& bounding_color_mat() const;   //RGB final cv::Mat
 
     bool empty() const {
         return m_empty;
@@ -56,13 +68,13 @@ struct sudoku_cell {
     const cv::Mat& mat(const config& conf) const {
         if(conf.big){
             if(conf.gray){
-                return bounding_gray_mat;
+                return bounding_gray_mat();
             } else {
-                return bounding_binary_mat;
+                return bounding_binary_mat();
             }
         } else {
             if(conf.gray){
-                return gray_mat;
+                return gray_mat();
             } else {
                 return binary_mat;
             }
@@ -73,21 +85,32 @@ struct sudoku_cell {
         return mat_to_image(mat(conf), conf.gray);
     }
 
+    //Write the image directly into a caller-provided buffer (e.g. a row of a batch)
+    template<typename T>
+    void image_to(T* image, const config& conf) const {
+        mat_to_image(mat(conf), image, conf.gray);
+    }
+
     template<typename T = double>
     etl::dyn_matrix<T, 1> image_1d(const config& conf) const {
-        return etl::dyn_matrix<T, 1>(image(conf));
+        decltype(auto) m = mat(conf);
+        etl::dyn_matrix<T, 1> r(m.size().height * m.size().width);
+        mat_to_image(m, r.memory_start(), conf.gray);
+        return r;
     }
 
     etl::dyn_matrix<double, 3> image_3d(const config& conf) const {
         decltype(auto) m = mat(conf);
         etl::dyn_matrix<double, 3> r(1, m.size().height, m.size().width);
-        r = mat_to_image(m, conf.gray);
+        mat_to_image(m, r.memory_start(), conf.gray);
         return r;
     }
 
     template<size_t W>
     etl::fast_dyn_matrix<double, 1, W, W> image_fast(const config& conf) const {
-        return etl::fast_dyn_matrix<double, 1, W, W>(image(conf));
+        etl::fast_dyn_matrix<double, 1, W, W> r;
+        mat_to_image(mat(conf), r.memory_start(), conf.gray);
+        return r;
     }
 };
 
@@ -96,6 +119,15 @@ struct sudoku_grid {
     std::string source_image_path;
     cv::Mat source_image;
 
+    //Contiguous storage for the binary planes of all the cells, the
+    //binary matrices of the cells are views in this arena. The other
+    //planes are only allocated when they are requested
+    cv::Mat binary_arena;
+
+    //Owner of the memory of binary_arena when it is not allocated by
+    //OpenCV (mapping of the cell cache), shared by the copies of the grid
+    std::shared_ptr<void> binary_storage;
+
     sudoku_cell& operator()(std::size_t x, std::size_t y){
         return cells[y * 9 + x];
     }
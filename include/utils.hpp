@@ -8,6 +8,11 @@
 #ifndef SUDOKU_UTILS_HPP
 #define SUDOKU_UTILS_HPP
 
+#include <cmath>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+
 template<typename T>
 T min(const std::vector<T>& vec){
     return *std::min_element(vec.begin(), vec.end());
@@ -28,11 +33,24 @@ T median(std::vector<T>& vec){
     std::sort(vec.begin(), vec.end());
 
     if(vec.size() % 2 == 0){
-        return vec[vec.size() / 2 + 1];
+        return (vec[vec.size() / 2 - 1] + vec[vec.size() / 2]) / 2.0;
     } else {
-        return (vec[vec.size() / 2] + vec[vec.size() / 2 + 1]) / 2.0;
+        return vec[vec.size() / 2];
     }
 }
 
+//Nearest-rank percentile (p in [0,100]) of an already sorted vector
+template<typename T>
+T sorted_percentile(const std::vector<T>& sorted, double p){
+    auto rank = static_cast<std::size_t>(std::ceil(p / 100.0 * sorted.size()));
+    return sorted[std::min(std::max(rank, std::size_t(1)), sorted.size()) - 1];
+}
+
+template<typename T>
+T percentile(std::vector<T>& vec, double p){
+    std::sort(vec.begin(), vec.end());
+    return sorted_percentile(vec, p);
+}
+
 
 #endif
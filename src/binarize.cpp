@@ -0,0 +1,338 @@
+//=======================================================================
+// Copyright Baptiste Wicht 2013-2015.
+// Distributed under the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "binarize.hpp"
+#include "sauvola.hpp"
+
+namespace {
+
+constexpr const int BINARIZE_STRIP = 64;  //Minimum number of rows streamed by a thread
+constexpr const int MEDIAN_CHUNK = 64;    //Number of columns going through the median network at once
+constexpr const int ADAPTIVE_BORDER = 5;  //Half of the adaptive block (11)
+constexpr const int SAUVOLA_BORDER = 11;  //Half of the Sauvola window (23)
+
+//Comparators (min to the first, max to the second) of a Batcher sorting
+//network of 32 values, with the 7 values after the 25 of the window
+//being +inf, pruned to the comparators the middle value (12) depends on.
+//Checked exhaustively on all the 0-1 inputs.
+const uint8_t median_network[][2] = {
+    {0, 1}, {2, 3}, {0, 2}, {1, 3}, {1, 2}, {4, 5}, {6, 7}, {4, 6},
+    {5, 7}, {5, 6}, {0, 4}, {2, 6}, {2, 4}, {1, 5}, {3, 7}, {3, 5},
+    {1, 2}, {3, 4}, {5, 6}, {8, 9}, {10, 11}, {8, 10}, {9, 11}, {9, 10},
+    {12, 13}, {14, 15}, {12, 14}, {13, 15}, {13, 14}, {8, 12}, {10, 14}, {10, 12},
+    {9, 13}, {11, 15}, {11, 13}, {9, 10}, {11, 12}, {13, 14}, {0, 8}, {4, 12},
+    {4, 8}, {2, 10}, {6, 14}, {6, 10}, {2, 4}, {6, 8}, {10, 12}, {1, 9},
+    {5, 13}, {5, 9}, {3, 11}, {7, 15}, {7, 11}, {3, 5}, {7, 9}, {11, 13},
+    {1, 2}, {3, 4}, {5, 6}, {7, 8}, {9, 10}, {11, 12}, {13, 14}, {16, 17},
+    {18, 19}, {16, 18}, {17, 19}, {17, 18}, {20, 21}, {22, 23}, {20, 22}, {21, 23},
+    {21, 22}, {16, 20}, {18, 22}, {18, 20}, {17, 21}, {19, 23}, {19, 21}, {17, 18},
+    {19, 20}, {21, 22}, {16, 24}, {20, 24}, {18, 20}, {22, 24}, {19, 21}, {17, 18},
+    {19, 20}, {21, 22}, {23, 24}, {0, 16}, {8, 24}, {8, 16}, {4, 20}, {12, 20},
+    {12, 16}, {2, 18}, {10, 18}, {6, 22}, {6, 10}, {10, 12}, {1, 17}, {9, 17},
+    {5, 21}, {13, 21}, {13, 17}, {3, 19}, {11, 19}, {7, 23}, {7, 11}, {11, 13},
+    {11, 12}
+};
+
+constexpr const int MEDIAN_VALUE = 12;
+
+inline int clamp(int i, int size){
+    return std::min(std::max(i, 0), size - 1);
+}
+
+//Rows of one step, only the last size rows are kept
+struct row_ring {
+    cv::Mat buffer;
+    int next = 0; //The next row to compute
+
+    void create(int size, int cols){
+        buffer.create(size, cols, CV_8U);
+    }
+
+    uint8_t* row(int r){
+        return buffer.ptr<uint8_t>(r % buffer.rows);
+    }
+};
+
+struct binarize_stream {
+    const cv::Mat& gray_image;
+    const bool sauvola;
+    const int rows;
+    const int cols;
+    const int border; //Half of the threshold window
+
+    row_ring median_1;  //Median of the gray image
+    row_ring threshold; //Threshold of median_1
+    row_ring median_2;  //Median of threshold
+
+    std::vector<int> column_sum;   //Sum of the window rows of median_1, per column (with the borders)
+    std::vector<int> column_sqsum; //Same with the squares (Sauvola only)
+    std::vector<int> window_sum;   //Sum of the window of each pixel
+    std::vector<int> window_sqsum; //Same with the squares (Sauvola only)
+    bool sums_ready = false;
+
+    std::vector<uint8_t> padded;   //The five rows of a median, with the replicated columns
+    std::vector<uint8_t> window;   //The 25 values of MEDIAN_CHUNK medians
+    std::vector<uint8_t> count_buffer; //Number of 255 per column of the second median
+
+    binarize_stream(const cv::Mat& gray_image, bool sauvola)
+            : gray_image(gray_image), sauvola(sauvola), rows(gray_image.rows), cols(gray_image.cols),
+              border(sauvola ? SAUVOLA_BORDER : ADAPTIVE_BORDER) {
+        //The oldest row of median_1 is needed to update the sums of the next row
+        median_1.create(2 * border + 2, cols);
+        threshold.create(5, cols);
+        median_2.create(3, cols);
+
+        column_sum.resize(cols + 2 * border);
+        column_sqsum.resize(sauvola ? cols + 2 * border : 0);
+        window_sum.resize(cols);
+        window_sqsum.resize(sauvola ? cols : 0);
+
+        //A complete chunk can always be read after the last column
+        padded.resize(5 * (cols + 4 + MEDIAN_CHUNK));
+        window.resize(25 * MEDIAN_CHUNK);
+        count_buffer.resize(cols + 4);
+    }
+
+    //Median of the 5x5 window of each column of the middle row
+    void median_row(const uint8_t* const source[5], uint8_t* dest){
+        const auto width = cols + 4 + MEDIAN_CHUNK;
+
+        for(int dy = 0; dy < 5; ++dy){
+            auto* p = &padded[dy * width];
+
+            p[0] = p[1] = source[dy][0];
+            std::copy(source[dy], source[dy] + cols, p + 2);
+            p[cols + 2] = p[cols + 3] = source[dy][cols - 1];
+        }
+
+        for(int j = 0; j < cols; j += MEDIAN_CHUNK){
+            for(int dy = 0; dy < 5; ++dy){
+                for(int dx = 0; dx < 5; ++dx){
+                    std::copy_n(&padded[dy * width + j + dx], MEDIAN_CHUNK, &window[(dy * 5 + dx) * MEDIAN_CHUNK]);
+                }
+            }
+
+            //Each comparator is applied on the complete chunk at once
+            for(auto& comparator : median_network){
+                auto* a = &window[comparator[0] * MEDIAN_CHUNK];
+                auto* b = &window[comparator[1] * MEDIAN_CHUNK];
+
+                for(int c = 0; c < MEDIAN_CHUNK; ++c){
+                    auto min = std::min(a[c], b[c]);
+                    auto max = std::max(a[c], b[c]);
+                    a[c] = min;
+                    b[c] = max;
+                }
+            }
+
+            std::copy_n(&window[MEDIAN_VALUE * MEDIAN_CHUNK], std::min(MEDIAN_CHUNK, cols - j), dest + j);
+        }
+    }
+
+    void compute_median_1(int r){
+        const uint8_t* source[5];
+        for(int dy = 0; dy < 5; ++dy){
+            source[dy] = gray_image.ptr<uint8_t>(clamp(r + dy - 2, rows));
+        }
+
+        median_row(source, median_1.row(r));
+    }
+
+    void compute_threshold(int r){
+        ensure(median_1, std::min(r + border, rows - 1), &binarize_stream::compute_median_1);
+
+        if(!sums_ready){
+            std::fill(column_sum.begin(), column_sum.end(), 0);
+            std::fill(column_sqsum.begin(), column_sqsum.end(), 0);
+
+            for(int k = r - border; k <= r + border; ++k){
+                add_row(median_1.row(clamp(k, rows)), 1);
+            }
+
+            sums_ready = true;
+        } else {
+            add_row(median_1.row(clamp(r - 1 - border, rows)), -1);
+            add_row(median_1.row(clamp(r + border, rows)), 1);
+        }
+
+        const auto* source = median_1.row(r);
+        auto* dest = threshold.row(r);
+
+        window_sums(column_sum, window_sum);
+
+        if(sauvola){
+            window_sums(column_sqsum, window_sqsum);
+
+            const double area = (2 * SAUVOLA_BORDER + 1) * (2 * SAUVOLA_BORDER + 1);
+
+            for(int j = 0; j < cols; ++j){
+                dest[j] = source[j] > sauvola_threshold(window_sum[j], window_sqsum[j], area, 0.2, 128.0) ? 255 : 0;
+            }
+        } else {
+            constexpr const int area = (2 * ADAPTIVE_BORDER + 1) * (2 * ADAPTIVE_BORDER + 1);
+
+            //Same rounding of the mean and same delta (2) as adaptiveThreshold
+            for(int j = 0; j < cols; ++j){
+                dest[j] = source[j] - (window_sum[j] + area / 2) / area > -2 ? 255 : 0;
+            }
+        }
+    }
+
+    //Add (or remove) a row of median_1 to the column sums and replicate
+    //the first and last columns in the borders
+    void add_row(const uint8_t* row, int sign){
+        auto* sum = &column_sum[border];
+
+        for(int j = 0; j < cols; ++j){
+            sum[j] += sign * row[j];
+        }
+
+        std::fill_n(column_sum.begin(), border, sum[0]);
+        std::fill_n(column_sum.begin() + border + cols, border, sum[cols - 1]);
+
+        if(sauvola){
+            auto* sqsum = &column_sqsum[border];
+
+            for(int j = 0; j < cols; ++j){
+                sqsum[j] += sign * row[j] * row[j];
+            }
+
+            std::fill_n(column_sqsum.begin(), border, sqsum[0]);
+            std::fill_n(column_sqsum.begin() + border + cols, border, sqsum[cols - 1]);
+        }
+    }
+
+    //Sums of the 2 * border + 1 column sums around each column
+    void window_sums(const std::vector<int>& column, std::vector<int>& window){
+        int s = 0;
+        for(int k = 0; k < 2 * border + 1; ++k){
+            s += column[k];
+        }
+
+        for(int j = 0; j < cols - 1; ++j){
+            window[j] = s;
+            s += column[j + 2 * border + 1] - column[j];
+        }
+
+        window[cols - 1] = s;
+    }
+
+    //The thresholded values are either 0 or 255, the median of the window
+    //is 255 when at least 13 of its 25 values are 255
+    void compute_median_2(int r){
+        ensure(threshold, std::min(r + 2, rows - 1), &binarize_stream::compute_threshold);
+
+        const uint8_t* source[5];
+        for(int dy = 0; dy < 5; ++dy){
+            source[dy] = threshold.row(clamp(r + dy - 2, rows));
+        }
+
+        //Number of 255 in the five rows of each column, with the replicated columns
+        auto* count = count_buffer.data();
+
+        for(int j = 0; j < cols; ++j){
+            count[j + 2] = (source[0][j] & 1) + (source[1][j] & 1) + (source[2][j] & 1) + (source[3][j] & 1) + (source[4][j] & 1);
+        }
+
+        count[0] = count[1] = count[2];
+        count[cols + 2] = count[cols + 3] = count[cols + 1];
+
+        auto* dest = median_2.row(r);
+
+        for(int j = 0; j < cols; ++j){
+            dest[j] = count[j] + count[j + 1] + count[j + 2] + count[j + 3] + count[j + 4] >= 13 ? 255 : 0;
+        }
+    }
+
+    //Dilation with the 3x3 cross, the pixels outside the image are
+    //ignored, which is the same as taking the center pixel in their place
+    void compute_dilate(int r, uint8_t* dest){
+        ensure(median_2, std::min(r + 1, rows - 1), &binarize_stream::compute_median_2);
+
+        const auto* center = median_2.row(r);
+        const auto* up = r > 0 ? median_2.row(r - 1) : center;
+        const auto* down = r < rows - 1 ? median_2.row(r + 1) : center;
+
+        auto cross = [&](int j, int left, int right){
+            return std::max(std::max(center[left], center[right]), std::max(center[j], std::max(up[j], down[j])));
+        };
+
+        dest[0] = cross(0, 0, std::min(1, cols - 1));
+
+        for(int j = 1; j < cols - 1; ++j){
+            dest[j] = cross(j, j - 1, j + 1);
+        }
+
+        if(cols > 1){
+            dest[cols - 1] = cross(cols - 1, cols - 2, cols - 1);
+        }
+    }
+
+    //Compute the rows of the step until last (included)
+    void ensure(row_ring& step, int last, void (binarize_stream::*compute)(int)){
+        for(; step.next <= last; ++step.next){
+            (this->*compute)(step.next);
+        }
+    }
+
+    //Stream the rows [first, last) to the destination
+    void run(int first, int last, cv::Mat& dest_image){
+        //The first rows of each step needed by the first row of the destination
+        median_2.next = std::max(first - 1, 0);
+        threshold.next = std::max(first - 3, 0);
+        median_1.next = std::max(first - 3 - border, 0);
+
+        for(int r = first; r < last; ++r){
+            compute_dilate(r, dest_image.ptr<uint8_t>(r));
+        }
+    }
+};
+
+struct stream_binarize_body : cv::ParallelLoopBody {
+    const cv::Mat& gray_image;
+    cv::Mat& dest_image;
+    const bool sauvola;
+
+    stream_binarize_body(const cv::Mat& gray_image, cv::Mat& dest_image, bool sauvola)
+            : gray_image(gray_image), dest_image(dest_image), sauvola(sauvola) {}
+
+    void operator()(const cv::Range& range) const override {
+        binarize_stream stream(gray_image, sauvola);
+        stream.run(range.start, range.end, dest_image);
+    }
+};
+
+} //end of anonymous namespace
+
+void binarize_steps(const cv::Mat& gray_image, cv::Mat& dest_image, bool sauvola){
+    cv::Mat blurred_image;
+    cv::medianBlur(gray_image, blurred_image, 5);
+
+    if(sauvola){
+        sauvola_binarize(blurred_image, dest_image, 2 * SAUVOLA_BORDER + 1);
+    } else {
+        cv::adaptiveThreshold(blurred_image, dest_image, 255, CV_ADAPTIVE_THRESH_MEAN_C, CV_THRESH_BINARY, 2 * ADAPTIVE_BORDER + 1, 2);
+    }
+
+    cv::medianBlur(dest_image, dest_image, 5);
+
+    auto structure_elem = cv::getStructuringElement(cv::MORPH_CROSS, cv::Size(3, 3));
+    cv::morphologyEx(dest_image, dest_image, cv::MORPH_DILATE, structure_elem);
+}
+
+void stream_binarize(const cv::Mat& gray_image, cv::Mat& dest_image, bool sauvola){
+    dest_image.create(gray_image.size(), CV_8U);
+
+    //One range of rows per thread, unless the ranges would be too small
+    const auto ranges = std::max(1, std::min(cv::getNumThreads(), gray_image.rows / BINARIZE_STRIP));
+
+    cv::parallel_for_(cv::Range(0, gray_image.rows), stream_binarize_body(gray_image, dest_image, sauvola), ranges);
+}
@@ -0,0 +1,264 @@
+//=======================================================================
+// Copyright Baptiste Wicht 2013-2015.
+// Distributed under the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <memory>
+#include <cstring>
+#include <cstdio>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "cell_cache.hpp"
+#include "detector.hpp"
+
+namespace {
+
+//Version of the layout of the file
+constexpr const uint32_t CACHE_VERSION = 2;
+
+constexpr const uint32_t SETTING_MIXED   = 1;
+constexpr const uint32_t SETTING_SAUVOLA = 2;
+constexpr const uint32_t SETTING_RECTIFY = 4;
+
+struct cache_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t settings;
+    uint32_t cell_size;
+    uint32_t detector;          //DETECTOR_VERSION of the detection
+    uint32_t opencv;            //OpenCV version of the decoding and detection
+
+    int64_t image_mtime;
+    int64_t image_size;
+    int64_t data_mtime;
+    int64_t data_size;
+
+    uint32_t cells;
+    uint32_t data_valid;
+    uint8_t results[81];
+};
+
+struct cache_cell {
+    uint8_t empty;
+    uint8_t digit;
+    uint8_t value;
+    uint8_t correct;
+    int32_t bounding[4];
+    int32_t digit_bounding[4];
+};
+
+const char CACHE_MAGIC[4] = {'S', 'D', 'K', 'C'};
+
+//Next to the image or in the cache directory, where the separators of
+//the image path are replaced so that all the images have their own file
+std::string cache_path(const std::string& image_path, const config& conf){
+    if(conf.cache_dir.empty()){
+        return image_path + ".cells";
+    }
+
+    auto name = image_path;
+    std::replace(name.begin(), name.end(), '/', '%');
+
+    return conf.cache_dir + "/" + name + ".cells";
+}
+
+//Same convention as read_data
+std::string data_path(const std::string& image_path){
+    std::string path(image_path);
+    path.replace(path.end() - 3, path.end(), "dat");
+    return path;
+}
+
+void file_stamp(const std::string& path, int64_t& mtime, int64_t& size){
+    struct stat st;
+    if(stat(path.c_str(), &st) == 0){
+        //In nanoseconds, a file rewritten in the same second is still seen
+        mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+        size = st.st_size;
+    } else {
+        mtime = -1;
+        size = -1;
+    }
+}
+
+cache_header make_header(const std::string& image_path, const config& conf){
+    cache_header header;
+    std::memset(&header, 0, sizeof(header));
+
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.settings = (conf.mixed ? SETTING_MIXED : 0) | (conf.sauvola ? SETTING_SAUVOLA : 0) | (conf.rectify ? SETTING_RECTIFY : 0);
+    header.cell_size = CELL_SIZE;
+    header.detector = DETECTOR_VERSION;
+    header.opencv = CV_MAJOR_VERSION * 10000 + CV_MINOR_VERSION * 100 + CV_SUBMINOR_VERSION;
+
+    file_stamp(image_path, header.image_mtime, header.image_size);
+    file_stamp(data_path(image_path), header.data_mtime, header.data_size);
+
+    return header;
+}
+
+void to_rect(const int32_t* values, cv::Rect& rect){
+    rect = cv::Rect(values[0], values[1], values[2], values[3]);
+}
+
+void from_rect(const cv::Rect& rect, int32_t* values){
+    values[0] = rect.x;
+    values[1] = rect.y;
+    values[2] = rect.width;
+    values[3] = rect.height;
+}
+
+} //end of anonymous namespace
+
+bool load_cell_cache(const std::string& image_path, const config& conf, sudoku_grid& grid, gt_data& data){
+    auto fd = open(cache_path(image_path, conf).c_str(), O_RDONLY);
+
+    if(fd < 0){
+        return false;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(cache_header)){
+        close(fd);
+        return false;
+    }
+
+    const std::size_t size = st.st_size;
+
+    //Private writable mapping, the planes can be modified in place like
+    //the ones of a detected grid, without modifying the file
+    auto* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if(memory == MAP_FAILED){
+        return false;
+    }
+
+    auto* bytes = static_cast<uint8_t*>(memory);
+
+    cache_header header;
+    std::memcpy(&header, bytes, sizeof(header));
+
+    auto expected = make_header(image_path, conf);
+
+    constexpr const std::size_t plane = CELL_SIZE * CELL_SIZE;
+
+    //The header must match everything except the cached values
+    bool valid =
+            std::memcmp(header.magic, expected.magic, sizeof(header.magic)) == 0
+        &&  header.version == expected.version
+        &&  header.settings == expected.settings
+        &&  header.cell_size == expected.cell_size
+        &&  header.detector == expected.detector
+        &&  header.opencv == expected.opencv
+        &&  header.image_mtime == expected.image_mtime
+        &&  header.image_size == expected.image_size
+        &&  header.data_mtime == expected.data_mtime
+        &&  header.data_size == expected.data_size
+        &&  size == sizeof(cache_header) + header.cells * (sizeof(cache_cell) + plane);
+
+    if(valid){
+        data = gt_data();
+        data.valid = header.data_valid;
+        std::memcpy(data.results, header.results, sizeof(header.results));
+
+        grid = sudoku_grid();
+        grid.source_image_path = image_path;
+
+        const auto n_cells = header.cells;
+        auto* cells = bytes + sizeof(cache_header);
+        auto* planes = cells + n_cells * sizeof(cache_cell);
+
+        //The arena is directly the planes of the mapping, which is only
+        //unmapped once the last copy of the grid is destroyed
+        grid.binary_storage = std::shared_ptr<void>(memory, [size](void* mapping){ munmap(mapping, size); });
+        grid.binary_arena = cv::Mat(n_cells * CELL_SIZE, CELL_SIZE, CV_8U, planes);
+
+        grid.cells.resize(n_cells);
+
+        for(std::size_t n = 0; n < n_cells; ++n){
+            cache_cell c;
+            std::memcpy(&c, cells + n * sizeof(cache_cell), sizeof(c));
+
+            auto& cell = grid.cells[n];
+            cell.m_empty = c.empty;
+            cell.m_digit = c.digit;
+            cell.m_value = c.value;
+            cell.m_correct = c.correct;
+            to_rect(c.bounding, cell.bounding);
+            to_rect(c.digit_bounding, cell.digit_bounding);
+            cell.binary_mat = grid.binary_arena.rowRange(n * CELL_SIZE, (n + 1) * CELL_SIZE);
+        }
+    }
+
+    if(!valid){
+        munmap(memory, size);
+    }
+
+    return valid;
+}
+
+void save_cell_cache(const std::string& image_path, const config& conf, const sudoku_grid& grid, const gt_data& data){
+    for(auto& cell : grid.cells){
+        if(cell.binary_mat.rows != int(CELL_SIZE) || cell.binary_mat.cols != int(CELL_SIZE) || cell.binary_mat.type() != CV_8U){
+            return;
+        }
+    }
+
+    auto header = make_header(image_path, conf);
+    header.cells = grid.cells.size();
+    header.data_valid = data.valid;
+    std::memcpy(header.results, data.results, sizeof(header.results));
+
+    //The cache directory is created on the first save (nothing to do if it exists)
+    if(!conf.cache_dir.empty()){
+        mkdir(conf.cache_dir.c_str(), 0755);
+    }
+
+    //Write a temporary file first, the cache is never seen half-written
+    auto path = cache_path(image_path, conf);
+    auto tmp_path = path + ".tmp";
+
+    {
+        std::ofstream stream(tmp_path, std::ios::binary);
+
+        stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        for(auto& cell : grid.cells){
+            cache_cell c;
+            std::memset(&c, 0, sizeof(c));
+            c.empty = cell.m_empty;
+            c.digit = cell.m_digit;
+            c.value = cell.m_value;
+            c.correct = cell.m_correct;
+            from_rect(cell.bounding, c.bounding);
+            from_rect(cell.digit_bounding, c.digit_bounding);
+
+            stream.write(reinterpret_cast<const char*>(&c), sizeof(c));
+        }
+
+        for(auto& cell : grid.cells){
+            for(int i = 0; i < cell.binary_mat.rows; ++i){
+                stream.write(reinterpret_cast<const char*>(cell.binary_mat.ptr<uint8_t>(i)), cell.binary_mat.cols);
+            }
+        }
+
+        if(!stream){
+            std::cout << "Impossible to write cache " << path << std::endl;
+            std::remove(tmp_path.c_str());
+            return;
+        }
+    }
+
+    std::rename(tmp_path.c_str(), path.c_str());
+}
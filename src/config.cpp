@@ -6,9 +6,31 @@
 //=======================================================================
 
 #include <iostream>
+#include <thread>
+#include <algorithm>
+#include <stdexcept>
 
 #include "config.hpp"
 
+namespace {
+
+//Parse the value of a numeric option, only plain decimal numbers are valid
+bool parse_number(const std::string& value, std::uint64_t& number){
+    if(value.empty() || !std::all_of(value.begin(), value.end(), [](char c){ return c >= '0' && c <= '9'; })){
+        return false;
+    }
+
+    try {
+        number = std::stoull(value);
+    } catch(const std::out_of_range&){
+        return false;
+    }
+
+    return true;
+}
+
+} //end of anonymous namespace
+
 void print_usage(){
     std::cout << "Usage: sudoku [options] <command> file [file...]" << std::endl;
     std::cout << "Supported commands: " << std::endl;
@@ -17,6 +39,8 @@ void print_usage(){
     std::cout << " * train" << std::endl;
     std::cout << " * recog" << std::endl;
     std::cout << " * recog_binary" << std::endl;
+    std::cout << " * serve [model]" << std::endl;
+    std::cout << " * solve [file...]" << std::endl;
     std::cout << " * time" << std::endl;
     std::cout << "Supported options: " << std::endl;
     std::cout << " -c : Convolutional DBN" << std::endl;
@@ -26,6 +50,16 @@ void print_usage(){
     std::cout << " -o : Oracle mode" << std::endl;
     std::cout << " -r : Shuffle input files" << std::endl;
     std::cout << " -g : Grid search during training" << std::endl;
+    std::cout << " -b : Sauvola binarization" << std::endl;
+    std::cout << " -k : Cache the detected cells next to the images" << std::endl;
+    std::cout << " -K dir : Cache the detected cells in dir (implies -k)" << std::endl;
+    std::cout << " -u : Count the solutions instead of solving (solve), add a SOLUTIONS line to the answers (serve)" << std::endl;
+    std::cout << " -w : Warp the grid into a square image before splitting it" << std::endl;
+    std::cout << " -j N : Use N worker threads (0 for all the cores, default 1, all the cores for solve)" << std::endl;
+    std::cout << " -S N : Seed of the random generation (fill)" << std::endl;
+    std::cout << " -W N : Number of warm-up runs (time)" << std::endl;
+    std::cout << " -R N : Number of timed runs (time)" << std::endl;
+    std::cout << " -F text|csv|json : Output format of the measures (time)" << std::endl;
 }
 
 config parse_args(int argc, char** argv){
@@ -35,6 +69,19 @@ config parse_args(int argc, char** argv){
         conf.args.emplace_back(argv[i]);
     }
 
+    //An invalid value leaves the command empty, the usage is printed
+    auto read_number = [&conf](std::size_t i, std::uint64_t& number){
+        if(parse_number(conf.args[i + 1], number)){
+            return true;
+        }
+
+        std::cout << "Invalid value for " << conf.args[i] << ": " << conf.args[i + 1] << std::endl;
+        return false;
+    };
+
+    std::uint64_t value = 0;
+    bool threads_set = false;
+
     std::size_t i = 0;
     for(; i < conf.args.size(); ++i){
         if(conf.args[i] == "-s"){
@@ -53,13 +100,61 @@ config parse_args(int argc, char** argv){
             conf.oracle = true;
         } else if(conf.args[i] == "-r"){
             conf.shuffle = true;
+        } else if(conf.args[i] == "-b"){
+            conf.sauvola = true;
+        } else if(conf.args[i] == "-k"){
+            conf.cache = true;
+        } else if(conf.args[i] == "-u"){
+            conf.unique = true;
+        } else if(conf.args[i] == "-w"){
+            conf.rectify = true;
+        } else if(conf.args[i] == "-j" && i + 1 < conf.args.size()){
+            if(!read_number(i++, value)){
+                return conf;
+            }
+
+            conf.threads = value ? value : std::max(1u, std::thread::hardware_concurrency());
+            threads_set = true;
+        } else if(conf.args[i] == "-S" && i + 1 < conf.args.size()){
+            if(!read_number(i++, value)){
+                return conf;
+            }
+
+            conf.seed = value;
+        } else if(conf.args[i] == "-W" && i + 1 < conf.args.size()){
+            if(!read_number(i++, value)){
+                return conf;
+            }
+
+            conf.warmup = value;
+        } else if(conf.args[i] == "-R" && i + 1 < conf.args.size()){
+            if(!read_number(i++, value)){
+                return conf;
+            }
+
+            conf.repeat = std::max<std::uint64_t>(1, value);
+        } else if(conf.args[i] == "-F" && i + 1 < conf.args.size()){
+            conf.format = conf.args[++i];
+        } else if(conf.args[i] == "-K" && i + 1 < conf.args.size()){
+            conf.cache = true;
+            conf.cache_dir = conf.args[++i];
         } else {
             break;
         }
     }
 
+    //Only options, no command
+    if(i == conf.args.size()){
+        return conf;
+    }
+
     conf.command = conf.args[i++];
 
+    //The puzzles are independent, solve uses all the cores by default
+    if(conf.command == "solve" && !threads_set){
+        conf.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
     for(; i < conf.args.size(); ++i){
         conf.files.push_back(conf.args[i]);
     }
@@ -6,10 +6,13 @@
 //=======================================================================
 
 #include "cpp_utils/data.hpp"
+#include "cpp_utils/stop_watch.hpp"
 
 #include "dataset.hpp"
 #include "detector.hpp"
 #include "image_utils.hpp"
+#include "pipeline.hpp"
+#include "cell_cache.hpp"
 
 //Real constants used to divide the dataset if necessary
 constexpr const std::size_t test_divide = 5;
@@ -34,21 +37,42 @@ dataset get_dataset(const config& conf){
 
     dataset ds;
 
-    for(auto& image_source_path : conf.files){
-        if(!conf.quiet){
-            std::cout << "Load and detect "<< image_source_path << std::endl;
+    struct loaded_grid {
+        bool valid = false;
+        bool cached = false;
+        sudoku_grid grid;
+        gt_data data;
+    };
+
+    //Load and detect the grids in parallel, they are added to the
+    //dataset in input order
+
+    cpp::stop_watch<std::chrono::milliseconds> watch;
+    std::size_t cached = 0;
+
+    ordered_pipeline(conf.files.size(), conf.threads, [&conf](std::size_t n){
+        loaded_grid loaded;
+
+        auto& image_source_path = conf.files[n];
+
+        //The cache only contains the binary planes of the detected cells
+        auto use_cache = conf.cache && !conf.oracle && !conf.gray && !conf.big;
+
+        if(use_cache && load_cell_cache(image_source_path, conf, loaded.grid, loaded.data)){
+            loaded.valid = true;
+            loaded.cached = true;
+            return loaded;
         }
 
         auto source_image = open_image(image_source_path);
 
         if (!source_image.data){
-            std::cout << "Invalid source_image" << std::endl;
-            continue;
+            return loaded;
         }
 
         cv::Mat source;
         if(conf.oracle){
-            sudoku_binarize(source_image, source);
+            sudoku_binarize(source_image, source, conf.sauvola);
         }
 
         //Read metadata
@@ -57,7 +81,8 @@ dataset get_dataset(const config& conf){
         auto pure_data = read_data_pure(image_source_path);
 
         cv::Mat dest_image;
-        auto grid = detect(source_image, dest_image, conf.mixed);
+        detection_context context(source_image, conf);
+        auto grid = detect(context, dest_image);
 
         grid.source_image_path = image_source_path;
 
@@ -81,23 +106,52 @@ dataset get_dataset(const config& conf){
                     cell.digit_bounding.width = width;
                     cell.digit_bounding.height = height;
 
-                    cell.color_mat = cv::Mat(source_image, cell.digit_bounding);
-                    cv::cvtColor(cell.color_mat, cell.gray_mat, CV_RGB2GRAY);
+                    cell.m_digit = true;
 
-                    cell_binarize(cell.gray_mat, cell.binary_mat, conf.mixed);
+                    cell_binarize(cell.gray_mat(), cell.binary_mat, conf.mixed, conf.sauvola);
                 }
 
                 cell.correct() = data.results[i][j];
+            }
+        }
+
+        if(use_cache){
+            save_cell_cache(image_source_path, conf, grid, data);
+        }
+
+        loaded.valid = true;
+        loaded.grid = std::move(grid);
+        loaded.data = data;
 
+        return loaded;
+    }, [&conf, &ds, &cached](std::size_t n, loaded_grid& loaded){
+        if(!conf.quiet){
+            std::cout << "Load and detect "<< conf.files[n] << std::endl;
+        }
+
+        if(!loaded.valid){
+            std::cout << "Invalid source_image" << std::endl;
+            return;
+        }
+
+        cached += loaded.cached;
+
+        auto& grid = loaded.grid;
+        auto& data = loaded.data;
+
+        for(size_t i = 0; i < 9; ++i){
+            for(size_t j = 0; j < 9; ++j){
                 if(data.results[i][j]){
                     ds.all_labels.push_back(data.results[i][j]-1);
-                    ds.all_images.emplace_back(cell.image(conf));
+                    ds.all_images.emplace_back(grid(j, i).image(conf));
                 }
             }
         }
 
-        ds.source_grids.push_back(grid);
-    }
+        ds.source_grids.push_back(std::move(grid));
+    });
+
+    std::cout << "Loaded " << conf.files.size() << " images (" << cached << " from the cell cache) in " << watch.elapsed() << "ms" << std::endl;
 
     for(auto& image : ds.all_images){
         preprocess(image, conf);
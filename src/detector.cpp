@@ -9,15 +9,24 @@
 #include <numeric>
 #include <array>
 #include <fstream>
+#include <limits>
+#include <cstdint>
+#include <unordered_map>
+#include <set>
+#include <mutex>
 
 #include <opencv2/opencv.hpp>
 
 #include "cpp_utils/algorithm.hpp"
+#include "cpp_utils/assert.hpp"
 
 #include "detector.hpp"
 #include "data.hpp"
 #include "trig_utils.hpp"
 #include "image_utils.hpp"
+#include "sauvola.hpp"
+#include "binarize.hpp"
+#include "detector_kernels.hpp"
 
 #ifdef HMM_EXPERIMENT
 #include "test_histogram.h"
@@ -102,7 +111,7 @@ std::vector<cv::Point2f> find_intersections(const std::vector<line_t>& lines, co
     }), intersections.end());
 
     //Make sure there are no duplicates
-    std::sort(intersections.begin(), intersections.end(), [](auto& a, auto& b){ return a.x < b.x && a.y < b.y; });
+    std::sort(intersections.begin(), intersections.end(), [](auto& a, auto& b){ return a.x < b.x || (a.x == b.x && a.y < b.y); });
     intersections.erase(std::unique(intersections.begin(), intersections.end()), intersections.end());
 
     return intersections;
@@ -212,6 +221,363 @@ bool intersects(const cv::Vec4i& v1, const cv::Vec4i& v2){
         &&  std::min(x3, x4) < x0 && std::max(x3, x4) > x0;
 }
 
+//Group the segments into clusters of (transitively) intersecting segments.
+//Two segments can only intersect if their bounding boxes overlap, therefore
+//the segments are put in the buckets of a uniform grid covered by their
+//bounding box and only the segments sharing a bucket are tested.
+//
+//The clusters are then merged exactly as the original pairwise algorithm
+//did (every pair (c1, c2) of clusters in order, c2 appended to c1 if they
+//intersect, until nothing changes), so that the segments of a cluster are
+//in the same order as before, merge_segments depends on this order. The
+//clusters intersecting a cluster are found from the intersecting pairs of
+//segments instead of testing all the pairs of clusters.
+std::vector<std::vector<cv::Vec4i>> cluster_segments(const std::vector<cv::Vec4i>& lines, const cv::Mat& image){
+    constexpr const int BUCKET_SIZE = 32;
+
+    const int buckets_x = image.cols / BUCKET_SIZE + 1;
+    const int buckets_y = image.rows / BUCKET_SIZE + 1;
+
+    auto bucket = [](int v, int buckets){
+        return std::min(std::max(v / BUCKET_SIZE, 0), buckets - 1);
+    };
+
+    std::vector<std::vector<std::size_t>> buckets(buckets_x * buckets_y);
+
+    for(std::size_t i = 0; i < lines.size(); ++i){
+        auto& l = lines[i];
+
+        //The boxes are enlarged by one pixel to be safe with rounding
+        auto bx1 = bucket(std::min(l[0], l[2]) - 1, buckets_x);
+        auto bx2 = bucket(std::max(l[0], l[2]) + 1, buckets_x);
+        auto by1 = bucket(std::min(l[1], l[3]) - 1, buckets_y);
+        auto by2 = bucket(std::max(l[1], l[3]) + 1, buckets_y);
+
+        for(int by = by1; by <= by2; ++by){
+            for(int bx = bx1; bx <= bx2; ++bx){
+                buckets[by * buckets_x + bx].push_back(i);
+            }
+        }
+    }
+
+    //The segments intersecting each segment
+    std::vector<std::vector<std::size_t>> neighbours(lines.size());
+
+    for(auto& b : buckets){
+        for(std::size_t i = 0; i < b.size(); ++i){
+            for(std::size_t j = i + 1; j < b.size(); ++j){
+                if(intersects(lines[b[i]], lines[b[j]])){
+                    neighbours[b[i]].push_back(b[j]);
+                    neighbours[b[j]].push_back(b[i]);
+                }
+            }
+        }
+    }
+
+    for(auto& n : neighbours){
+        std::sort(n.begin(), n.end());
+        n.erase(std::unique(n.begin(), n.end()), n.end());
+    }
+
+    //Initially, each segment is its own cluster, at its own position
+    std::vector<std::vector<std::size_t>> members(lines.size());
+    std::vector<std::size_t> owner(lines.size());
+
+    for(std::size_t i = 0; i < lines.size(); ++i){
+        members[i].push_back(i);
+        owner[i] = i;
+    }
+
+    //The clusters after the cursor intersecting the current cluster
+    std::set<std::size_t> candidates;
+
+    auto add_candidates = [&](std::size_t segment, std::size_t cursor){
+        for(auto n : neighbours[segment]){
+            if(owner[n] > cursor){
+                candidates.insert(owner[n]);
+            }
+        }
+    };
+
+    bool merged_cluster;
+    do {
+        merged_cluster = false;
+
+        for(std::size_t i = 0; i < members.size(); ++i){
+            if(members[i].empty()){
+                continue;
+            }
+
+            candidates.clear();
+
+            for(auto segment : members[i]){
+                add_candidates(segment, i);
+            }
+
+            //The clusters are visited in order, each merge can make the
+            //next clusters intersect, but not the previous ones
+            while(!candidates.empty()){
+                auto j = *candidates.begin();
+                candidates.erase(candidates.begin());
+
+                auto first = members[i].size();
+
+                for(auto segment : members[j]){
+                    owner[segment] = i;
+                    members[i].push_back(segment);
+                }
+
+                members[j].clear();
+
+                for(auto k = first; k < members[i].size(); ++k){
+                    add_candidates(members[i][k], j);
+                }
+
+                merged_cluster = true;
+            }
+        }
+    } while(merged_cluster);
+
+    std::vector<std::vector<cv::Vec4i>> clusters;
+
+    for(auto& cluster : members){
+        if(!cluster.empty()){
+            clusters.emplace_back();
+
+            for(auto segment : cluster){
+                clusters.back().push_back(lines[segment]);
+            }
+        }
+    }
+
+    return clusters;
+}
+
+//Merge v2 into v1, keeping the two farthest end points
+void merge_segment(cv::Vec4i& v1, const cv::Vec4i& v2){
+    cv::Point2f a(v1[0], v1[1]);
+    cv::Point2f b(v1[2], v1[3]);
+    cv::Point2f c(v2[0], v2[1]);
+    cv::Point2f d(v2[2], v2[3]);
+
+    auto dab = euclidean_distance(a, b);
+    auto dac = euclidean_distance(a, c);
+    auto dad = euclidean_distance(a, d);
+    auto dbc = euclidean_distance(b, c);
+    auto dbd = euclidean_distance(b, d);
+    auto dcd = euclidean_distance(c, d);
+
+    auto max = std::max(dab, std::max(dac, std::max(dad, std::max(dbc, std::max(dbd, dcd)))));
+
+    if(dab  == max){
+        //No change in v1
+    } else if(dac == max){
+        v1[2] = v2[0];
+        v1[3] = v2[1];
+    } else if(dad == max){
+        v1[2] = v2[2];
+        v1[3] = v2[3];
+    } else if(dbc == max){
+        v1[0] = v1[2];
+        v1[1] = v1[3];
+        v1[2] = v2[0];
+        v1[3] = v2[1];
+    } else if(dbd == max){
+        v1[0] = v1[2];
+        v1[1] = v1[3];
+        v1[2] = v2[2];
+        v1[3] = v2[3];
+    } else if(dcd == max){
+        v1 = v2;
+    }
+}
+
+//Index of segments by their angle and their distance to the center
+//of the segments (Hough space). The bins are large enough for two
+//segments accepted by on_same_line to always be in neighbour bins.
+struct segment_index {
+    //Bins of 0.112 rad, on_same_line accepts less than 0.1 rad
+    static constexpr const int angle_bins = 28;
+
+    cv::Point2f center;
+    float radius;
+    float rho_width;
+    int rho_bins;
+
+    std::vector<std::vector<std::size_t>> bins;
+
+    explicit segment_index(const std::vector<cv::Vec4i>& segments){
+        float min_x = 0.0f, max_x = 0.0f, min_y = 0.0f, max_y = 0.0f;
+
+        if(!segments.empty()){
+            min_x = max_x = segments.front()[0];
+            min_y = max_y = segments.front()[1];
+        }
+
+        for(auto& v : segments){
+            min_x = std::min(min_x, float(std::min(v[0], v[2])));
+            max_x = std::max(max_x, float(std::max(v[0], v[2])));
+            min_y = std::min(min_y, float(std::min(v[1], v[3])));
+            max_y = std::max(max_y, float(std::max(v[1], v[3])));
+        }
+
+        center = cv::Point2f((min_x + max_x) / 2.0f, (min_y + max_y) / 2.0f);
+        radius = euclidean_distance(center, cv::Point2f(max_x, max_y));
+
+        //The normals of two segments accepted by on_same_line differ by
+        //less than 0.1, the 10 pixels of on_same_line are added on top
+        rho_width = 0.12f * radius + 11.0f;
+        rho_bins = int(2.0f * radius / rho_width) + 1;
+
+        bins.resize(angle_bins * rho_bins);
+    }
+
+    static bool degenerate(const cv::Vec4i& v){
+        return v[0] == v[2] && v[1] == v[3];
+    }
+
+    //The angle bin and the signed distance of the line to the center
+    std::pair<int, float> key(const cv::Vec4i& v) const {
+        auto phi = std::atan2(float(v[3] - v[1]), float(v[2] - v[0]));
+
+        if(phi < 0.0f){
+            phi += CV_PI;
+        }
+
+        auto angle = std::min(std::max(int(phi / (CV_PI / angle_bins)), 0), angle_bins - 1);
+        auto rho = -std::sin(phi) * (v[0] - center.x) + std::cos(phi) * (v[1] - center.y);
+
+        return {angle, rho};
+    }
+
+    int rho_bin(float rho) const {
+        return std::min(std::max(int((rho + radius) / rho_width), 0), rho_bins - 1);
+    }
+
+    std::vector<std::size_t>& bin(const cv::Vec4i& v){
+        auto k = key(v);
+        return bins[k.first * rho_bins + rho_bin(k.second)];
+    }
+
+    void insert(const cv::Vec4i& v, std::size_t i){
+        if(!degenerate(v)){
+            bin(v).push_back(i);
+        }
+    }
+
+    void erase(const cv::Vec4i& v, std::size_t i){
+        if(!degenerate(v)){
+            auto& b = bin(v);
+            b.erase(std::find(b.begin(), b.end(), i));
+        }
+    }
+
+    //Call functor with each segment that may be on the same line as v
+    template<typename Functor>
+    void neighbours(const cv::Vec4i& v, Functor&& functor) const {
+        if(degenerate(v)){
+            return;
+        }
+
+        auto k = key(v);
+
+        for(int da = -1; da <= 1; ++da){
+            auto a = k.first + da;
+            auto rho = k.second;
+
+            //Past 0 or PI, the direction (and the normal) is reversed
+            if(a < 0 || a >= angle_bins){
+                a = (a + angle_bins) % angle_bins;
+                rho = -rho;
+            }
+
+            auto r = rho_bin(rho);
+
+            for(int dr = std::max(r - 1, 0); dr <= std::min(r + 1, rho_bins - 1); ++dr){
+                for(auto i : bins[a * rho_bins + dr]){
+                    functor(i);
+                }
+            }
+        }
+    }
+};
+
+//Merge the segments that are on the same line. The result is the same as
+//scanning the segments from the start, merging all the following segments
+//on the same line as the current one and restarting after each merge, but
+//only the segments of the neighbour bins are compared and the scan is
+//restarted directly at the first segment that can merge again.
+void merge_segments(std::vector<cv::Vec4i>& segments){
+    const auto n = segments.size();
+
+    segment_index index(segments);
+    std::vector<bool> alive(n, true);
+
+    for(std::size_t i = 0; i < n; ++i){
+        index.insert(segments[i], i);
+    }
+
+    std::size_t i = 0;
+    while(i < n){
+        if(!alive[i]){
+            ++i;
+            continue;
+        }
+
+        bool merged = false;
+        std::size_t last = i;
+
+        while(true){
+            //The first following segment on the same line as segment i
+            std::size_t j = n;
+            index.neighbours(segments[i], [&](std::size_t c){
+                if(c > last && c < j && on_same_line(segments[i], segments[c])){
+                    j = c;
+                }
+            });
+
+            if(j == n){
+                break;
+            }
+
+            index.erase(segments[i], i);
+            index.erase(segments[j], j);
+
+            merge_segment(segments[i], segments[j]);
+            alive[j] = false;
+
+            index.insert(segments[i], i);
+
+            last = j;
+            merged = true;
+        }
+
+        if(merged){
+            //The previous segments did not match any segment, except maybe
+            //the segment that just grew
+            std::size_t k = i;
+            index.neighbours(segments[i], [&](std::size_t c){
+                if(c < k && on_same_line(segments[c], segments[i])){
+                    k = c;
+                }
+            });
+
+            i = k;
+        } else {
+            ++i;
+        }
+    }
+
+    std::size_t j = 0;
+    for(std::size_t i = 0; i < n; ++i){
+        if(alive[i]){
+            segments[j++] = segments[i];
+        }
+    }
+
+    segments.resize(j);
+}
+
 float angle_rad(const cv::Point2f& a, const cv::Point2f& b){
     return acos(a.dot(b) / (norm(a) * norm(b)));
 }
@@ -230,18 +596,72 @@ std::vector<T> make_vector(std::initializer_list<T> list){
     return {list};
 }
 
+//Each point goes to the first cluster whose gravity center is closer than
+//10 pixels or starts a new cluster. The gravity centers are maintained
+//incrementally and hashed in a grid of 10x10 cells, therefore only the
+//clusters of the 3x3 neighbour cells have to be tested.
 std::vector<std::vector<cv::Point2f>> cluster(const std::vector<cv::Point2f>& intersections){
+    constexpr const float CLUSTER_DISTANCE = 10.0f;
+
     std::vector<std::vector<cv::Point2f>> clusters;
+    std::vector<cv::Point2f> sums;
+    std::vector<cv::Point2f> centers;
+
+    std::unordered_map<std::uint64_t, std::vector<std::size_t>> grid;
+
+    auto cell = [](float v){
+        return static_cast<std::int64_t>(std::floor(v / CLUSTER_DISTANCE));
+    };
+
+    //The cells are negative for the intersections outside of the image,
+    //the shift is done on unsigned values
+    auto key = [](std::int64_t x, std::int64_t y){
+        return (static_cast<std::uint64_t>(x) << 32) ^ static_cast<std::uint32_t>(y);
+    };
 
     for(auto& i : intersections){
-        auto it = std::find_if(clusters.begin(), clusters.end(), [&i](auto& cluster){
-            return distance_to_gravity(i, cluster) < 10.0f;
-        });
+        auto cx = cell(i.x);
+        auto cy = cell(i.y);
+
+        //The oldest matching cluster, as a linear search would find it
+        auto c = clusters.size();
+
+        for(auto x = cx - 1; x <= cx + 1; ++x){
+            for(auto y = cy - 1; y <= cy + 1; ++y){
+                auto it = grid.find(key(x, y));
 
-        if(it == clusters.end()){
+                if(it != grid.end()){
+                    for(auto candidate : it->second){
+                        if(candidate < c && euclidean_distance(i, centers[candidate]) < CLUSTER_DISTANCE){
+                            c = candidate;
+                        }
+                    }
+                }
+            }
+        }
+
+        if(c == clusters.size()){
             clusters.push_back({i});
+            sums.push_back(i);
+            centers.push_back(i);
+
+            grid[key(cx, cy)].push_back(c);
         } else {
-            it->push_back(i);
+            auto& center = centers[c];
+            auto old_key = key(cell(center.x), cell(center.y));
+
+            clusters[c].push_back(i);
+            sums[c].x += i.x;
+            sums[c].y += i.y;
+            center = cv::Point2f(sums[c].x / clusters[c].size(), sums[c].y / clusters[c].size());
+
+            auto new_key = key(cell(center.x), cell(center.y));
+
+            if(new_key != old_key){
+                auto& old_cell = grid[old_key];
+                old_cell.erase(std::find(old_cell.begin(), old_cell.end(), c));
+                grid[new_key].push_back(c);
+            }
         }
     }
 
@@ -261,7 +681,15 @@ std::vector<cv::Point2f> compute_hull(const std::vector<cv::Point2f>& points){
     return hull;
 }
 
-std::vector<cv::Rect> compute_grid(const std::vector<cv::Point2f>& hull, cv::Mat& dest_image){
+//The grid as two sides: the lines of the grid go from a_p + t * a_vec to b_p + t * b_vec
+struct grid_frame {
+    cv::Point2f a_p;
+    cv::Point2f a_vec;
+    cv::Point2f b_p;
+    cv::Point2f b_vec;
+};
+
+grid_frame compute_frame(const std::vector<cv::Point2f>& hull, cv::Mat& dest_image){
     std::vector<cv::Point2f> corners;
 
     float prev = 0.0;
@@ -313,10 +741,12 @@ std::vector<cv::Rect> compute_grid(const std::vector<cv::Point2f>& hull, cv::Mat
         cv::putText(dest_image, "BR", corners[br], cv::FONT_HERSHEY_PLAIN, 0.5f, cv::Scalar(0,255,25));
     }
 
-    cv::Point2f a_vec;
-    cv::Point2f b_vec;
-    cv::Point2f a_p;
-    cv::Point2f b_p;
+    grid_frame frame;
+
+    auto& a_vec = frame.a_vec;
+    auto& b_vec = frame.b_vec;
+    auto& a_p = frame.a_p;
+    auto& b_p = frame.b_p;
 
     if(std::fabs(corners[tl].y - corners[(tl+1) % 4].y) > std::fabs(corners[tl].y - corners[(tl+3)%4].y)){
         a_p = corners[(tl+1) % 4];
@@ -330,6 +760,17 @@ std::vector<cv::Rect> compute_grid(const std::vector<cv::Point2f>& hull, cv::Mat
         b_vec = corners[(tl + 2) % 4] - corners[(tl + 1) % 4];
     }
 
+    return frame;
+}
+
+std::vector<cv::Rect> compute_grid(const std::vector<cv::Point2f>& hull, cv::Mat& dest_image){
+    auto frame = compute_frame(hull, dest_image);
+
+    auto& a_vec = frame.a_vec;
+    auto& b_vec = frame.b_vec;
+    auto& a_p = frame.a_p;
+    auto& b_p = frame.b_p;
+
     std::array<line_t, 10> vectors;
 
     auto cell_factor = 1.0f / 9.0f;
@@ -374,6 +815,84 @@ std::vector<cv::Rect> compute_grid(const std::vector<cv::Point2f>& hull, cv::Mat
     return cells;
 }
 
+//Draw a rect of the rectified image at its position in the source image
+void draw_rectified(cv::Mat& dest_image, const cv::Mat& transform, const cv::Rect& rect, const cv::Scalar& color, int thickness){
+    std::vector<cv::Point2f> corners = {
+        cv::Point2f(rect.x, rect.y), cv::Point2f(rect.x + rect.width, rect.y),
+        cv::Point2f(rect.x + rect.width, rect.y + rect.height), cv::Point2f(rect.x, rect.y + rect.height)};
+
+    std::vector<cv::Point2f> source_corners;
+    cv::perspectiveTransform(corners, source_corners, transform.inv());
+
+    for(std::size_t i = 0; i < 4; ++i){
+        cv::line(dest_image, source_corners[i], source_corners[(i + 1) % 4], color, thickness, CV_AA);
+    }
+}
+
+//Warp the grid into a square image of 9x9 cells of BIG_CELL_SIZE pixels.
+//The binary image of the source, already computed for the lines, is
+//warped with the source image, so the rectified image is never binarized
+//again. The source and binary images of the context are replaced by the
+//warped images, which only contain the grid and have always the same
+//size, and the cells and lines are set to their canonical positions. The
+//drawings are still done on the source image.
+void rectify_grid(detection_context& context, cv::Mat& dest_image){
+    auto frame = compute_frame(context.hull, dest_image);
+
+    const int cell_size = BIG_CELL_SIZE;
+    const int size = 9 * cell_size;
+
+    cv::Point2f source_points[4] = {frame.a_p, frame.b_p, frame.a_p + frame.a_vec, frame.b_p + frame.b_vec};
+    cv::Point2f dest_points[4] = {
+        cv::Point2f(0.0f, 0.0f), cv::Point2f(size, 0.0f),
+        cv::Point2f(0.0f, size), cv::Point2f(size, size)};
+
+    auto transform = cv::getPerspectiveTransform(source_points, dest_points);
+
+    //A binary image must stay binary
+    cv::Mat warped_binary;
+    cv::warpPerspective(context.binary(), warped_binary, transform, cv::Size(size, size), cv::INTER_NEAREST, cv::BORDER_REPLICATE);
+
+    cv::Mat warped_image;
+    if(context.source_image.type() == CV_8U){
+        warped_image = warped_binary;
+    } else {
+        cv::warpPerspective(context.source_image, warped_image, transform, cv::Size(size, size), cv::INTER_LINEAR, cv::BORDER_REPLICATE);
+    }
+
+    context.source_image = warped_image;
+    context.binary_image = warped_binary;
+    context.gray_image.release();
+    context.edges_image.release();
+    context.rectify_transform = transform;
+
+    context.cells.resize(9 * 9);
+
+    for(int j = 0; j < 9; ++j){
+        for(int i = 0; i < 9; ++i){
+            context.cells[i + j * 9] = cv::Rect(i * cell_size, j * cell_size, cell_size, cell_size);
+        }
+    }
+
+    context.lines.clear();
+
+    for(int t = 0; t < 10; ++t){
+        context.lines.emplace_back(cv::Point2f(t * cell_size, 0.0f), cv::Point2f(t * cell_size, size));
+        context.lines.emplace_back(cv::Point2f(0.0f, t * cell_size), cv::Point2f(size, t * cell_size));
+    }
+
+    if(SHOW_CELLS){
+        for(auto& cell : context.cells){
+            draw_rectified(dest_image, transform, cell, cv::Scalar(0, 0, 255), 1);
+        }
+    }
+}
+
+//View on the plane of the nth cell inside an arena of square planes
+cv::Mat arena_view(cv::Mat& arena, std::size_t n, std::size_t size){
+    return arena.rowRange(n * size, (n + 1) * size);
+}
+
 std::vector<cv::Point2f> to_float_points(const std::vector<cv::Point>& vec){
     return cpp::vector_transform(vec.begin(), vec.end(), [](auto& i){return cv::Point2f(i.x, i.y);});
 }
@@ -385,17 +904,17 @@ void show_regrid(sudoku_grid& grid, int mode){
         || (mode == 3 && SHOW_LARGE_REGRID) || (mode == 4 && SHOW_LARGE_REGRID_GRAY) || (mode == 5 && SHOW_LARGE_REGRID_COLOR)){
         auto size = mode > 2 ? BIG_CELL_SIZE : CELL_SIZE;
 
-        cv::Mat remat(cv::Size(size * 9, size * 9), (mode == 2 || mode == 5) ? grid(0,0).color_mat.type() : grid(0,0).binary_mat.type());
+        cv::Mat remat(cv::Size(size * 9, size * 9), (mode == 2 || mode == 5) ? grid(0,0).source_image.type() : grid(0,0).binary_mat.type());
 
         for(std::size_t i = 0; i < 9; ++i){
             for(std::size_t j = 0; j < 9; ++j){
                 const auto& mat =
                         mode == 0 ? grid(i, j).binary_mat :
-                        mode == 1 ? grid(i, j).gray_mat :
-                        mode == 2 ? grid(i, j).color_mat :
-                        mode == 3 ? grid(i, j).bounding_binary_mat :
-                        mode == 4 ? grid(i ,j).bounding_gray_mat :
-                                    grid(i, j).bounding_color_mat;
+                        mode == 1 ? grid(i, j).gray_mat() :
+                        mode == 2 ? grid(i, j).color_mat() :
+                        mode == 3 ? grid(i, j).bounding_binary_mat() :
+                        mode == 4 ? grid(i ,j).bounding_gray_mat() :
+                                    grid(i, j).bounding_color_mat();
 
                 mat.copyTo(remat(cv::Rect(i * size, j * size, size, size)));
             }
@@ -406,42 +925,172 @@ void show_regrid(sudoku_grid& grid, int mode){
     }
 }
 
-void sudoku_binarize(const cv::Mat& source_image, cv::Mat& dest_image){
+void sudoku_binarize(const cv::Mat& source_image, cv::Mat& dest_image, bool sauvola){
     cv::Mat gray_image;
     cv::cvtColor(source_image, gray_image, CV_RGB2GRAY);
 
-    cv::medianBlur(gray_image, gray_image, 5);
+    sudoku_binarize_gray(gray_image, dest_image, sauvola);
+}
+
+namespace {
+
+//The streaming binarization must give exactly the same image as the
+//OpenCV filters, it is checked once on a noisy gradient, with both
+//thresholds and with several ranges of rows
+bool check_stream_binarize(){
+    cv::Mat gray_image(157, 211, CV_8U);
+
+    cv::RNG rng(42);
+    for(int i = 0; i < gray_image.rows; ++i){
+        for(int j = 0; j < gray_image.cols; ++j){
+            gray_image.at<uint8_t>(i, j) = cv::saturate_cast<uint8_t>(64 + (i + 2 * j) % 128 + rng.uniform(-40, 40));
+        }
+    }
+
+    bool same = true;
+
+    for(bool sauvola : {false, true}){
+        cv::Mat expected;
+        cv::Mat streamed;
 
-    cv::adaptiveThreshold(gray_image, dest_image, 255, CV_ADAPTIVE_THRESH_MEAN_C, CV_THRESH_BINARY, 11, 2);
+        binarize_steps(gray_image, expected, sauvola);
+        stream_binarize(gray_image, streamed, sauvola);
+
+        same = same && cv::countNonZero(expected != streamed) == 0;
+    }
 
-    cv::medianBlur(dest_image, dest_image, 5);
+    if(!same){
+        std::cerr << "WARNING: The streaming binarization differs from the OpenCV filters, the filters are used" << std::endl;
+    }
 
-    auto structure_elem = cv::getStructuringElement(cv::MORPH_CROSS, cv::Size(3, 3));
-    cv::morphologyEx(dest_image, dest_image, cv::MORPH_DILATE, structure_elem);
+    return same;
+}
+
+} //end of anonymous namespace
+
+void sudoku_binarize_gray(const cv::Mat& gray_image, cv::Mat& dest_image, bool sauvola){
+    static const bool streaming = check_stream_binarize();
+
+    //Always a new image, gray_image and dest_image may be the same
+    cv::Mat binary_image;
+
+    if(streaming){
+        stream_binarize(gray_image, binary_image, sauvola);
+    } else {
+        binarize_steps(gray_image, binary_image, sauvola);
+    }
+
+    dest_image = binary_image;
 }
 
 //Cell binarization can probably be improved a lot
-void cell_binarize(const cv::Mat& gray_image, cv::Mat& dest_image, bool mixed){
-    dest_image = gray_image.clone();
-    cv::adaptiveThreshold(gray_image, dest_image, 255, CV_ADAPTIVE_THRESH_MEAN_C, CV_THRESH_BINARY, 7, 2);
+void cell_binarize(const cv::Mat& gray_image, cv::Mat& dest_image, bool mixed, bool sauvola){
+    //No reallocation when dest_image already has the correct size (arena view)
+    if(sauvola){
+        sauvola_binarize(gray_image, dest_image, 11);
+    } else {
+        cv::adaptiveThreshold(gray_image, dest_image, 255, CV_ADAPTIVE_THRESH_MEAN_C, CV_THRESH_BINARY, 7, 2);
+    }
 
     if(!mixed){
         cv::medianBlur(dest_image, dest_image, 3);
     }
 }
 
+const cv::Mat& detection_context::gray(){
+    if(gray_image.empty()){
+        if(source_image.type() == CV_8U){
+            gray_image = source_image;
+        } else {
+            cv::cvtColor(source_image, gray_image, CV_RGB2GRAY);
+        }
+    }
+
+    return gray_image;
+}
+
+const cv::Mat& detection_context::binary(){
+    if(binary_image.empty()){
+        //An 8U source image is already binary
+        if(source_image.type() == CV_8U){
+            binary_image = source_image;
+        } else {
+            sudoku_binarize_gray(gray(), binary_image, sauvola);
+        }
+    }
+
+    return binary_image;
+}
+
+const cv::Mat& detection_context::edges(){
+    if(edges_image.empty()){
+        std::size_t CANNY = 150;
+        cv::Canny(binary(), edges_image, CANNY, CANNY * 4, 5);
+    }
+
+    return edges_image;
+}
+
 std::vector<line_t> detect_lines(const cv::Mat& source_image, cv::Mat& dest_image, bool mixed){
-    cv::Mat binary_image;
-    sudoku_binarize(source_image, binary_image);
+    detection_context context(source_image, mixed);
+    return detect_lines(context, dest_image);
+}
 
-    return detect_lines_binary(binary_image, dest_image, mixed);
+std::vector<line_t>& detect_lines(detection_context& context, cv::Mat& dest_image){
+    context.lines = detect_lines_binary(context.binary(), dest_image, context.mixed);
+    return context.lines;
 }
 
-std::vector<line_t> detect_lines_binary(const cv::Mat& binary_image, cv::Mat& dest_image, bool /*mixed*/){
-    std::vector<line_t> final_lines;
+line_t extend_line_stepping(cv::Point2f a, cv::Point2f b, const cv::Size& size){
+    cv::Vec2f u(b.x - a.x, b.y - a.y);
+    u /= norm(u);
 
-    //1. Detect lines
+    while(b.x < size.width && b.y < size.height && b.x > 0 && b.y > 0){
+        b.x += u[0];
+        b.y += u[1];
+    }
+
+    b.x -= u[0];
+    b.y -= u[1];
+
+    while(a.x < size.width && a.y < size.height && a.x > 0 && a.y > 0){
+        a.x -= u[0];
+        a.y -= u[1];
+    }
+
+    a.x += u[0];
+    a.y += u[1];
+
+    return {a, b};
+}
+
+namespace {
+
+//Number of steps of u from p to get out of the image (0 if p is already outside)
+float steps_to_border(const cv::Point2f& p, const cv::Vec2f& u, const cv::Size& size){
+    if(!(p.x < size.width && p.y < size.height && p.x > 0 && p.y > 0)){
+        return 0.0f;
+    }
+
+    auto steps = std::numeric_limits<float>::infinity();
+
+    if(u[0] > 0.0f){
+        steps = std::min(steps, std::ceil((size.width - p.x) / u[0]));
+    } else if(u[0] < 0.0f){
+        steps = std::min(steps, std::ceil(p.x / -u[0]));
+    }
+
+    if(u[1] > 0.0f){
+        steps = std::min(steps, std::ceil((size.height - p.y) / u[1]));
+    } else if(u[1] < 0.0f){
+        steps = std::min(steps, std::ceil(p.y / -u[1]));
+    }
+
+    return steps;
+}
 
+//Raw segments of the edges of the binary image
+std::vector<cv::Vec4i> detect_segments(const cv::Mat& binary_image){
     cv::Mat lines_image;
     constexpr const size_t CANNY_THRESHOLD = 60;
     cv::Canny(binary_image, lines_image, CANNY_THRESHOLD, CANNY_THRESHOLD * 3, 5);
@@ -449,6 +1098,31 @@ std::vector<line_t> detect_lines_binary(const cv::Mat& binary_image, cv::Mat& de
     std::vector<cv::Vec4i> lines;
     cv::HoughLinesP(lines_image, lines, 1, CV_PI/180, 50, 50, 12);
 
+    return lines;
+}
+
+} //end of anonymous namespace
+
+line_t extend_line(const cv::Point2f& a, const cv::Point2f& b, const cv::Size& size){
+    cv::Vec2f u(b.x - a.x, b.y - a.y);
+    u /= norm(u);
+
+    //The last point before the border, as found by stepping
+    auto kb = steps_to_border(b, u, size) - 1.0f;
+    auto ka = steps_to_border(a, -u, size) - 1.0f;
+
+    return {
+        cv::Point2f(a.x - ka * u[0], a.y - ka * u[1]),
+        cv::Point2f(b.x + kb * u[0], b.y + kb * u[1])};
+}
+
+std::vector<line_t> detect_lines_binary(const cv::Mat& binary_image, cv::Mat& dest_image, bool /*mixed*/){
+    std::vector<line_t> final_lines;
+
+    //1. Detect lines
+
+    auto lines = detect_segments(binary_image);
+
     IF_DEBUG std::cout << lines.size() << " lines found" << std::endl;
 
     //If Hough failed, there is no sense filtering it
@@ -470,27 +1144,7 @@ std::vector<line_t> detect_lines_binary(const cv::Mat& binary_image, cv::Mat& de
         l[1] -= u[1];
     }
 
-    auto clusters = cpp::vector_transform(lines.begin(), lines.end(), [](auto& v) -> std::vector<cv::Vec4i> {
-        return {v};
-    });
-
-    bool merged_cluster;
-    do {
-        merged_cluster = false;
-
-        cpp::foreach_pair(clusters.begin(), clusters.end(), [&merged_cluster](auto& c1, auto& c2){
-            for(auto& v1 : c1){
-                for(auto& v2 : c2){
-                    if(intersects(v1, v2)){
-                        std::copy(c2.begin(), c2.end(), std::back_inserter(c1));
-                        c2.clear();
-                        merged_cluster = true;
-                        return;
-                    }
-                }
-            }
-        });
-    } while(merged_cluster);
+    auto clusters = cluster_segments(lines, binary_image);
 
     IF_DEBUG std::cout << clusters.size() << " clusters found" << std::endl;
 
@@ -510,68 +1164,7 @@ std::vector<line_t> detect_lines_binary(const cv::Mat& binary_image, cv::Mat& de
 
     //3. Merge line segments into bigger segments
 
-    bool merged;
-    do {
-        merged = false;
-
-        auto it = max_cluster.begin();
-
-        while(it != max_cluster.end()){
-            auto& v1 = *it;
-
-            auto before = max_cluster.size();
-            max_cluster.erase(std::remove_if(std::next(it), max_cluster.end(), [&v1](auto& v2){
-                if(on_same_line(v1, v2)){
-                    cv::Point2f a(v1[0], v1[1]);
-                    cv::Point2f b(v1[2], v1[3]);
-                    cv::Point2f c(v2[0], v2[1]);
-                    cv::Point2f d(v2[2], v2[3]);
-
-                    auto dab = euclidean_distance(a, b);
-                    auto dac = euclidean_distance(a, c);
-                    auto dad = euclidean_distance(a, d);
-                    auto dbc = euclidean_distance(b, c);
-                    auto dbd = euclidean_distance(b, d);
-                    auto dcd = euclidean_distance(c, d);
-
-                    auto max = std::max(dab, std::max(dac, std::max(dad, std::max(dbc, std::max(dbd, dcd)))));
-
-                    if(dab  == max){
-                        //No change in v1
-                    } else if(dac == max){
-                        v1[2] = v2[0];
-                        v1[3] = v2[1];
-                    } else if(dad == max){
-                        v1[2] = v2[2];
-                        v1[3] = v2[3];
-                    } else if(dbc == max){
-                        v1[0] = v1[2];
-                        v1[1] = v1[3];
-                        v1[2] = v2[0];
-                        v1[3] = v2[1];
-                    } else if(dbd == max){
-                        v1[0] = v1[2];
-                        v1[1] = v1[3];
-                        v1[2] = v2[2];
-                        v1[3] = v2[3];
-                    } else if(dcd == max){
-                        v1 = v2;
-                    }
-
-                    return true;
-                } else {
-                    return false;
-                }
-            }), max_cluster.end());
-
-            if(max_cluster.size() != before){
-                merged = true;
-                break;
-            }
-
-            ++it;
-        }
-    } while(merged);
+    merge_segments(max_cluster);
 
     if(SHOW_MERGED_LINE_SEGMENTS){
         for(auto& l : max_cluster){
@@ -586,29 +1179,7 @@ std::vector<line_t> detect_lines_binary(const cv::Mat& binary_image, cv::Mat& de
     std::vector<line_t> long_lines;
 
     for(auto& l : max_cluster){
-        cv::Point2f a(l[0], l[1]);
-        cv::Point2f b(l[2], l[3]);
-
-        cv::Vec2f u(b.x - a.x, b.y - a.y);
-        u /= norm(u);
-
-        while(b.x < binary_image.cols && b.y < binary_image.rows && b.x > 0 && b.y > 0){
-            b.x += u[0];
-            b.y += u[1];
-        }
-
-        b.x -= u[0];
-        b.y -= u[1];
-
-        while(a.x < binary_image.cols && a.y < binary_image.rows && a.x > 0 && a.y > 0){
-            a.x -= u[0];
-            a.y -= u[1];
-        }
-
-        a.x += u[0];
-        a.y += u[1];
-
-        long_lines.emplace_back(a, b);
+        long_lines.push_back(extend_line(cv::Point2f(l[0], l[1]), cv::Point2f(l[2], l[3]), binary_image.size()));
     }
 
     if(SHOW_LONG_LINES){
@@ -785,8 +1356,24 @@ std::vector<line_t> detect_lines_binary(const cv::Mat& binary_image, cv::Mat& de
 }
 
 std::vector<cv::Rect> detect_grid(const cv::Mat& source_image, cv::Mat& dest_image, std::vector<line_t>& lines, bool mixed){
+    detection_context context(source_image, mixed);
+    context.lines = lines;
+    return detect_grid(context, dest_image);
+}
+
+std::vector<cv::Rect>& detect_grid(detection_context& context, cv::Mat& dest_image){
+    const auto& source_image = context.source_image;
+    const auto& lines = context.lines;
+    const auto mixed = context.mixed;
+
+    auto& hull = context.hull;
+    auto& cells = context.cells;
+
+    hull.clear();
+    cells.clear();
+
     if(lines.empty()){
-        return {};
+        return cells;
     }
 
     auto intersections = find_intersections(lines, source_image);
@@ -806,8 +1393,6 @@ std::vector<cv::Rect> detect_grid(const cv::Mat& source_image, cv::Mat& dest_ima
 
     IF_DEBUG std::cout << points.size() << " clustered intersections found" << std::endl;
 
-    std::vector<cv::Point2f> hull;
-
     //If the detected lines are optimal, the number of intersection is 100
     //In that case, no need to more post processing, just get the grid around
     //the points
@@ -818,11 +1403,8 @@ std::vector<cv::Rect> detect_grid(const cv::Mat& source_image, cv::Mat& dest_ima
     } else {
         IF_DEBUG std::cout << "Contour Hull" << std::endl;
 
-        cv::Mat dest_image_gray;
-        sudoku_binarize(source_image, dest_image_gray);
-
-        std::size_t CANNY = 150;
-        cv::Canny(dest_image_gray, dest_image_gray, CANNY, CANNY * 4, 5);
+        //findContours modifies its input image
+        auto dest_image_gray = context.edges().clone();
 
         std::vector<std::vector<cv::Point>> contours;
         std::vector<cv::Vec4i> hierarchy;
@@ -868,7 +1450,13 @@ std::vector<cv::Rect> detect_grid(const cv::Mat& source_image, cv::Mat& dest_ima
         cv::fillPoly(dest_image, contours, cv::Scalar(128, 128, 0));
     }
 
-    return compute_grid(hull, dest_image);
+    if(context.rectify){
+        rectify_grid(context, dest_image);
+    } else {
+        cells = compute_grid(hull, dest_image);
+    }
+
+    return cells;
 }
 
 cv::Rect to_square(cv::Rect rect){
@@ -887,8 +1475,86 @@ cv::Rect to_square(cv::Rect rect){
     return square;
 }
 
+namespace {
+
+cv::Rect bounding_square(const cv::Rect& bounding){
+    auto bounding_rect = bounding;
+    bounding_rect.x += 5;
+    bounding_rect.y += 5;
+    bounding_rect.width -= 10;
+    bounding_rect.height -= 10;
+
+    return to_square(bounding_rect);
+}
+
+} //end of anonymous namespace
+
+const cv::Mat& sudoku_cell::gray_mat() const {
+    if(m_gray_mat.empty()){
+        if(m_digit){
+            cpp_assert(!source_image.empty(), "No source image, the grids of the cell cache only have binary planes");
+
+            //In color/gray mode, we cannot simple pad the image with black/white pixel, therefore we increase the size of the rect
+            cv::Mat gray_square;
+            cv::cvtColor(cv::Mat(source_image, to_square(digit_bounding)), gray_square, CV_RGB2GRAY);
+            cv::resize(gray_square, m_gray_mat, cv::Size(CELL_SIZE, CELL_SIZE), 0, 0, cv::INTER_CUBIC);
+        } else {
+            m_gray_mat.create(CELL_SIZE, CELL_SIZE, CV_8U);
+            m_gray_mat = cv::Scalar(255);
+        }
+    }
+
+    return m_gray_mat;
+}
+
+const cv::Mat& sudoku_cell::color_mat() const {
+    if(m_color_mat.empty()){
+        cpp_assert(!source_image.empty(), "No source image, the grids of the cell cache only have binary planes");
+
+        if(m_digit){
+            cv::resize(cv::Mat(source_image, to_square(digit_bounding)), m_color_mat, cv::Size(CELL_SIZE, CELL_SIZE), 0, 0, cv::INTER_CUBIC);
+        } else {
+            m_color_mat.create(CELL_SIZE, CELL_SIZE, source_image.type());
+            m_color_mat = cv::Scalar(255, 255, 255);
+        }
+    }
+
+    return m_color_mat;
+}
+
+const cv::Mat& sudoku_cell::bounding_color_mat() const {
+    if(m_bounding_color_mat.empty()){
+        cpp_assert(!source_image.empty(), "No source image, the grids of the cell cache only have binary planes");
+
+        cv::resize(cv::Mat(source_image, bounding_square(bounding)), m_bounding_color_mat, cv::Size(BIG_CELL_SIZE, BIG_CELL_SIZE), 0, 0, cv::INTER_CUBIC);
+    }
+
+    return m_bounding_color_mat;
+}
+
+const cv::Mat& sudoku_cell::bounding_gray_mat() const {
+    if(m_bounding_gray_mat.empty()){
+        cpp_assert(!source_image.empty(), "No source image, the grids of the cell cache only have binary planes");
+
+        cv::Mat gray_square;
+        cv::cvtColor(cv::Mat(source_image, bounding_square(bounding)), gray_square, CV_RGB2GRAY);
+        cv::resize(gray_square, m_bounding_gray_mat, cv::Size(BIG_CELL_SIZE, BIG_CELL_SIZE), 0, 0, cv::INTER_CUBIC);
+    }
+
+    return m_bounding_gray_mat;
+}
+
+const cv::Mat& sudoku_cell::bounding_binary_mat() const {
+    if(m_bounding_binary_mat.empty()){
+        //Binarize again because resize goes back to GRAY
+        cell_binarize(bounding_gray_mat(), m_bounding_binary_mat, false, m_sauvola);
+    }
+
+    return m_bounding_binary_mat;
+}
+
 template<bool X>
-std::pair<std::size_t, std::size_t> find_best(std::vector<int>& histo, std::size_t width, std::size_t min_width, std::size_t max_width){
+std::pair<std::size_t, std::size_t> find_best(const std::vector<int>& histo, std::size_t width, std::size_t min_width, std::size_t max_width){
     auto max = 0.0;
     auto max_sx = 0;
     auto max_l = 0;
@@ -898,19 +1564,37 @@ std::pair<std::size_t, std::size_t> find_best(std::vector<int>& histo, std::size
     auto w_avg_avg = 0.1;               //find peaks
     auto w_l_ratio = 0.32;              //find large zones
 
+    if(histo.empty()){
+        return {max_sx, max_l};
+    }
+
+    //The global max does not depend on the window
+    const double histo_max = *std::max_element(histo.begin(), histo.end());
+
+    //For a given start, the max and the area of the window are updated
+    //as the window grows instead of being recomputed for each length
+
     for(std::size_t sx = 0; sx < width; ++sx){
+        auto max_intensity = 0;
+        auto area = 0.0;
+
+        for(std::size_t x = 0; x + 1 < min_width && sx + x < width; ++x){
+            max_intensity = std::max(max_intensity, histo[sx + x]);
+            area += histo[sx + x];
+        }
+
         for(std::size_t l = min_width; l < max_width && sx + l < width; ++l){
+            //The window is [sx, sx + l)
+            if(l > 0){
+                max_intensity = std::max(max_intensity, histo[sx + l - 1]);
+                area += histo[sx + l - 1];
+            }
+
             //1. Displacement to the center (in [0,1])
             auto cx_dx = 1.0 - std::fabs(width / 2.0 - (sx + l / 2.0)) / (width / 2.0);
 
             //2. Max intensity (absolute)
 
-            auto max_intensity = 0;
-
-            for(std::size_t x = 0; x < l; ++x){
-                max_intensity = std::max(max_intensity, histo[sx + x]);
-            }
-
             //Don't take risks
             if(max_intensity == 0){
                 continue;
@@ -920,14 +1604,6 @@ std::pair<std::size_t, std::size_t> find_best(std::vector<int>& histo, std::size
 
             auto total_area = max_intensity * l;
 
-            //4. Area (absolute)
-
-            auto area = 0.0;
-
-            for(std::size_t x = 0; x < l; ++x){
-                area += histo[sx + x];
-            }
-
             //4. Fill ratio (in [0,1])
 
             auto fill_ratio = area / total_area;
@@ -938,7 +1614,7 @@ std::pair<std::size_t, std::size_t> find_best(std::vector<int>& histo, std::size
 
             //6. Averaged average intensity (in [0,1])
 
-            auto avg_avg = avg / *std::max_element(histo.begin(), histo.end());
+            auto avg_avg = avg / histo_max;
 
             //7. Length ratio (in [0,1])
 
@@ -961,83 +1637,296 @@ std::pair<std::size_t, std::size_t> find_best(std::vector<int>& histo, std::size
 
 #ifdef HMM_EXPERIMENT
 
-static model_t* x_model;
-static model_t* y_model;
+//Each thread loads its own copy of the models, they are never shared,
+//so test_histogram can run on several threads without a lock. They are
+//freed when the thread exits
+struct hmm_models {
+    model_t* x_model;
+    model_t* y_model;
+
+    hmm_models(){
+        //Only the loading is serialized, nothing tells that the parser
+        //of the library is reentrant
+        static std::mutex load_lock;
+        std::lock_guard<std::mutex> l(load_lock);
 
-std::pair<std::size_t, std::size_t> hmm_look(std::vector<int>& histo, bool xxx){
-    if(!x_model){
         x_model = initialization_model("hmm/Matrix_Fer_x.json");
         y_model = initialization_model("hmm/Matrix_Fer_y.json");
     }
 
-    auto T = histo.size();
+    hmm_models(const hmm_models&) = delete;
+    hmm_models& operator=(const hmm_models&) = delete;
 
-    std::vector<double> test(T);
-    std::copy(histo.begin(), histo.end(), test.begin());
+    ~hmm_models(){
+        free_model(x_model);
+        free_model(y_model);
+    }
+};
 
-    auto max = static_cast<double>(*std::max_element(test.begin(), test.end()));
-    auto min = static_cast<double>(*std::min_element(test.begin(), test.end()));
+//Regression delta of the window N: d[t] = sum n * (c[t+n] - c[t-n]) / (2 * sum n^2)
+//with the indices clamped to the sequence
+void delta_coeff(const double* c, double* d, std::size_t T, std::size_t N){
+    const long last = static_cast<long>(T) - 1;
 
-    for(auto& t : test){
-        t = (t - min) / (max - min);
+    double norm = 0.0;
+    for(std::size_t n = 1; n <= N; ++n){
+        norm += 2.0 * n * n;
     }
 
-    // example
-    double* res = delta_coeff_arr(test.data(), T, 2);
-    double* res2 = delta_2coeff_arr(test.data(), T, 2);
+    for(long t = 0; t <= last; ++t){
+        double sum = 0.0;
+
+        for(long n = 1; n <= static_cast<long>(N); ++n){
+            sum += n * (c[std::min(t + n, last)] - c[std::max(t - n, 0L)]);
+        }
 
-    // allocate the memory
-    double* Test_Vect[3];
-    for (int i = 0; i < 3; i++){
-        Test_Vect[i] = new double[T];
+        d[t] = sum / norm;
     }
+}
+
+//The models were trained on the deltas of the library, the in-place
+//deltas are only used if they give the same values on a probe sequence.
+//Otherwise, the arrays allocated by the library are used for each cell
+bool check_delta_coeff(){
+    constexpr const std::size_t T = 37;
+
+    std::array<double, T> c;
+    std::array<double, T> d;
+    std::array<double, T> d2;
+
+    for(std::size_t t = 0; t < T; ++t){
+        c[t] = ((t * 7919) % 101) / 100.0;
+    }
+
+    delta_coeff(c.data(), d.data(), T, 2);
+    delta_coeff(d.data(), d2.data(), T, 2);
+
+    double* res = delta_coeff_arr(c.data(), T, 2);
+    double* res2 = delta_2coeff_arr(c.data(), T, 2);
 
-    for (std::size_t j = 0; j < T; j++){
-        Test_Vect[0][j] = test[j];
-        Test_Vect[1][j] = res[j];
-        Test_Vect[2][j] = res2[j];
+    bool same = true;
+    for(std::size_t t = 0; t < T; ++t){
+        same = same && std::fabs(res[t] - d[t]) < 1e-9 && std::fabs(res2[t] - d2[t]) < 1e-9;
     }
 
     free(res);
     free(res2);
 
+    if(!same){
+        std::cerr << "WARNING: The HMM deltas differ from the library ones, the library is used for each cell" << std::endl;
+    }
+
+    return same;
+}
+
+//Buffers reused from one cell to the next by each thread, they only
+//grow, so a thread stops allocating after its first cells
+struct hmm_scratch {
+    std::vector<double> test;
+    std::vector<double> delta;
+    std::vector<double> delta_2;
+    std::vector<int> align;
+
+    void resize(std::size_t T){
+        test.resize(T);
+        delta.resize(T);
+        delta_2.resize(T);
+        align.resize(T);
+    }
+};
+
+std::pair<std::size_t, std::size_t> hmm_look(const std::vector<int>& histo, bool xxx){
+    static const bool in_place_deltas = check_delta_coeff();
+
+    thread_local hmm_models models;
+    thread_local hmm_scratch scratch;
+
+    auto T = histo.size();
+
+    scratch.resize(T);
+
+    auto& test = scratch.test;
+
+    auto max = static_cast<double>(*std::max_element(histo.begin(), histo.end()));
+    auto min = static_cast<double>(*std::min_element(histo.begin(), histo.end()));
+
+    for(std::size_t j = 0; j < T; ++j){
+        test[j] = (histo[j] - min) / (max - min);
+    }
+
+    double* res = nullptr;
+    double* res2 = nullptr;
+
+    if(in_place_deltas){
+        delta_coeff(test.data(), scratch.delta.data(), T, 2);
+        delta_coeff(scratch.delta.data(), scratch.delta_2.data(), T, 2);
+    } else {
+        res = delta_coeff_arr(test.data(), T, 2);
+        res2 = delta_2coeff_arr(test.data(), T, 2);
+    }
+
+    double* Test_Vect[3] = {test.data(), in_place_deltas ? scratch.delta.data() : res, in_place_deltas ? scratch.delta_2.data() : res2};
+
     // number of classes
     int NClasses = 1;
-    std::vector<int> Align(T);
+    auto& Align = scratch.align;
 
-    test_histogram(xxx ? x_model : y_model, Test_Vect, T, NClasses, Align.data());
+    test_histogram(xxx ? models.x_model : models.y_model, Test_Vect, T, NClasses, Align.data());
+
+    free(res);
+    free(res2);
 
     auto start = std::distance(Align.begin(), std::find(Align.begin(), Align.end(), 4));
     auto end = T - std::distance(Align.rbegin(), std::find(Align.rbegin(), Align.rend(), 4));
 
-    // free the allocated memory
-    for (int i = 0; i < 3; i++){
-        delete[] Test_Vect[i];
+    return std::make_pair(start, end);
+}
+
+#endif
+
+namespace {
+
+//Split a rectified grid (-w): all the cells are at their canonical
+//position in the warped binary image, they are sliced directly, without
+//searching the digits in contours. The digit of a cell is the bounding
+//box of the ink inside the cell, away from the grid lines
+sudoku_grid split_rectified(detection_context& context, cv::Mat& dest_image){
+    const auto& source_image = context.source_image;
+    const auto& binary_image = context.binary();
+    const auto& cells = context.cells;
+
+    sudoku_grid grid;
+    grid.source_image = source_image;
+
+    const auto n_cells = cells.size();
+
+    grid.binary_arena.create(n_cells * CELL_SIZE, CELL_SIZE, CV_8U);
+    grid.binary_arena = cv::Scalar(255);
+
+    grid.cells.reserve(n_cells);
+
+    cv::Mat ink;
+    std::vector<cv::Point> ink_points;
+    cv::Mat digit_plane;
+
+    for(size_t n = 0; n < n_cells; ++n){
+        grid.cells.emplace_back();
+        auto& cell = grid.cells.back();
+
+        cell.binary_mat = arena_view(grid.binary_arena, n, CELL_SIZE);
+        cell.source_image = source_image;
+        cell.m_sauvola = context.sauvola;
+        cell.bounding = cells[n];
+
+        const auto& bounding = cell.bounding;
+
+        //The grid lines are in the border of the cell
+        const int margin = bounding.width / 8;
+        const cv::Rect inner(bounding.x + margin, bounding.y + margin, bounding.width - 2 * margin, bounding.height - 2 * margin);
+
+        //The digits are black on white
+        cv::threshold(cv::Mat(binary_image, inner), ink, 127, 255, cv::THRESH_BINARY_INV);
+
+        //Less than 3% of ink is only noise
+        if(cv::countNonZero(ink) < 0.03 * inner.area()){
+            continue;
+        }
+
+        cv::findNonZero(ink, ink_points);
+
+        auto rect = cv::boundingRect(ink_points);
+
+        if(rect.height < inner.height / 4){
+            continue;
+        }
+
+        rect.x += inner.x;
+        rect.y += inner.y;
+
+        //Center the digit in a square, kept inside the cell
+        auto dim = std::min(std::max(rect.width, rect.height), bounding.width);
+
+        cv::Rect square(rect.x + (rect.width - dim) / 2, rect.y + (rect.height - dim) / 2, dim, dim);
+        square.x = std::min(std::max(square.x, bounding.x), bounding.x + bounding.width - dim);
+        square.y = std::min(std::max(square.y, bounding.y), bounding.y + bounding.height - dim);
+
+        //Only the ink of the digit is kept, not the one of the lines
+        digit_plane.create(dim, dim, CV_8U);
+        digit_plane = cv::Scalar(255);
+
+        auto digit = rect & square;
+        cv::Mat(binary_image, digit).copyTo(digit_plane(cv::Rect(digit.x - square.x, digit.y - square.y, digit.width, digit.height)));
+
+        cv::resize(digit_plane, cell.binary_mat, cell.binary_mat.size(), 0, 0, cv::INTER_AREA);
+        cv::threshold(cell.binary_mat, cell.binary_mat, 127, 255, cv::THRESH_BINARY);
+
+        cell.digit_bounding = square;
+        cell.m_digit = true;
+        cell.m_empty = fill_factor(cell.binary_mat) == 1.0f;
+
+        if(SHOW_CHAR_CELLS){
+            draw_rectified(dest_image, context.rectify_transform, square, cv::Scalar(255, 0, 0), 2);
+        }
     }
 
-    //delete[] Align;
+    show_regrid(grid, 0);
+    show_regrid(grid, 1);
+    show_regrid(grid, 2);
+    show_regrid(grid, 3);
+    show_regrid(grid, 4);
+    show_regrid(grid, 5);
 
-    return std::make_pair(start, end);
+    return grid;
 }
 
-#endif
+} //end of anonymous namespace
 
 sudoku_grid split(const cv::Mat& source_image, cv::Mat& dest_image, const std::vector<cv::Rect>& cells, std::vector<line_t>& lines, bool mixed){
-    sudoku_grid grid;
-    grid.source_image = source_image.clone(); //TODO constructor
+    detection_context context(source_image, mixed);
+    context.lines = lines;
+    context.cells = cells;
+
+    auto grid = split(context, dest_image);
+
+    lines = context.lines;
+
+    return grid;
+}
+
+sudoku_grid split(detection_context& context, cv::Mat& dest_image){
+    const auto& source_image = context.source_image;
+    const auto& cells = context.cells;
+    const auto mixed = context.mixed;
+    const auto sauvola = context.sauvola;
+
+    auto& lines = context.lines;
 
     if(cells.empty()){
         IF_DEBUG std::cout << "No cell provided, no splitting" << std::endl;
+        sudoku_grid grid;
+        grid.source_image = source_image;
         return grid;
     }
 
-    cv::Mat source;
-    if(source_image.type() == CV_8U){
-        source = source_image;
-    } else {
-        sudoku_binarize(source_image, source);
+    if(!context.rectify_transform.empty()){
+        return split_rectified(context, dest_image);
     }
 
+    sudoku_grid grid;
+    grid.source_image = source_image;
+
+    //The lines are drawn on source, it must never be the binary image itself
+    cv::Mat source = context.binary().clone();
+
+    //All the binary planes are stored in a single arena
+
+    const auto n_cells = cells.size();
+
+    grid.binary_arena.create(n_cells * CELL_SIZE, CELL_SIZE, source.type());
+    grid.binary_arena = cv::Scalar(255);
+
+    grid.cells.reserve(n_cells);
+
     if(lines.size() > 20){
         lines.erase(std::remove_if(lines.begin(), lines.end(), [&cells](auto& line){
             std::size_t near = 0;
@@ -1062,38 +1951,14 @@ sudoku_grid split(const cv::Mat& source_image, cv::Mat& dest_image, const std::v
         grid.cells.emplace_back();
         auto& cell = grid.cells.back();
 
-        cell.binary_mat = cv::Mat(cv::Size(CELL_SIZE, CELL_SIZE), source.type());
-        cell.gray_mat = cv::Mat(cv::Size(CELL_SIZE, CELL_SIZE), source.type());
-        cell.color_mat = cv::Mat(cv::Size(CELL_SIZE, CELL_SIZE), source_image.type());
-
-        cell.bounding_binary_mat = cv::Mat(cv::Size(BIG_CELL_SIZE, BIG_CELL_SIZE), source.type());
-        cell.bounding_gray_mat = cv::Mat(cv::Size(BIG_CELL_SIZE, BIG_CELL_SIZE), source.type());
-        cell.bounding_color_mat = cv::Mat(cv::Size(BIG_CELL_SIZE, BIG_CELL_SIZE), source_image.type());
-
-        cell.binary_mat = cv::Scalar(255);
+        cell.binary_mat = arena_view(grid.binary_arena, n, CELL_SIZE);
+        cell.source_image = source_image;
+        cell.m_sauvola = context.sauvola;
 
         cell.bounding = ensure_inside(source, cells[n]);
 
         const auto& bounding = cell.bounding;
 
-        auto bounding_rect = bounding;
-        bounding_rect.x += 5;
-        bounding_rect.y += 5;
-        bounding_rect.width -= 10;
-        bounding_rect.height -= 10;
-
-        auto bounding_square = to_square(bounding_rect);
-
-        cv::Mat bounding_color_mat(source_image, bounding_square);
-        cv::Mat bounding_gray_mat(source_image, bounding_square);
-        cv::cvtColor(bounding_color_mat, bounding_gray_mat, CV_RGB2GRAY);
-
-        cv::resize(bounding_color_mat, cell.bounding_color_mat, cv::Size(BIG_CELL_SIZE, BIG_CELL_SIZE), 0, 0, cv::INTER_CUBIC);
-        cv::resize(bounding_gray_mat, cell.bounding_gray_mat, cv::Size(BIG_CELL_SIZE, BIG_CELL_SIZE), 0, 0, cv::INTER_CUBIC);
-
-        //Binarize again because resize goes back to GRAY
-        cell_binarize(cell.bounding_gray_mat, cell.bounding_binary_mat, false);
-
         //Clear bounding image of  the cell
         cv::Mat rect_image_clean(source, bounding);
 
@@ -1106,15 +1971,16 @@ sudoku_grid split(const cv::Mat& source_image, cv::Mat& dest_image, const std::v
             auto width = rect_image.size().width;
             auto height = rect_image.size().height;
 
-            std::vector<int> histo_x(width, 0);
-            std::vector<int> histo_y(height, 0);
+            //Darkness histograms of the columns and of the rows
+            cv::Mat inverted = cv::Scalar::all(255) - rect_image_gray;
 
-            for(int x = 0; x < width; ++x){
-                for(int y = 0; y < height; ++y){
-                    histo_x[x] += 255 - rect_image_gray.at<uchar>(cv::Point(x, y));
-                    histo_y[y] += 255 - rect_image_gray.at<uchar>(cv::Point(x, y));
-                }
-            }
+            cv::Mat sum_x;
+            cv::Mat sum_y;
+            cv::reduce(inverted, sum_x, 0, CV_REDUCE_SUM, CV_32S);
+            cv::reduce(inverted, sum_y, 1, CV_REDUCE_SUM, CV_32S);
+
+            std::vector<int> histo_x(sum_x.ptr<int>(0), sum_x.ptr<int>(0) + width);
+            std::vector<int> histo_y(sum_y.begin<int>(), sum_y.end<int>());
 
             std::size_t x_start, x_end, y_start, y_end;
             std::tie(x_start, x_end) = hmm_look(histo_x, true);
@@ -1162,7 +2028,7 @@ sudoku_grid split(const cv::Mat& source_image, cv::Mat& dest_image, const std::v
             cv::Mat rect_image_gray = rect_image.clone();
             cv::cvtColor(rect_image, rect_image_gray, CV_RGB2GRAY);
             cv::Mat rect_image_binary = rect_image_gray.clone();
-            cell_binarize(rect_image_gray, rect_image_binary, mixed);
+            cell_binarize(rect_image_gray, rect_image_binary, mixed, sauvola);
 
             cv::Canny(rect_image_binary, rect_image_binary, 4, 12);
 
@@ -1338,15 +2204,6 @@ sudoku_grid split(const cv::Mat& source_image, cv::Mat& dest_image, const std::v
             binary_final_square = cv::Scalar(255,255,255);
             binary_final_rect.copyTo(binary_final_square(cv::Rect((dim - rect.width) / 2, (dim - rect.height) / 2, rect.width, rect.height)));
 
-            //In color/gray mode, we cannot simple pad the image with black/white pixel, therefore we increase the size of the rect
-            auto color_square_rect = to_square(big_rect);
-
-            //Extract the gray and color images (not yet resized)
-
-            cv::Mat gray_final_square(source_image, color_square_rect);
-            cv::cvtColor(gray_final_square, gray_final_square, CV_RGB2GRAY);
-            cv::Mat color_final_square(source_image, color_square_rect);
-
             //Prune the final candidates
 
             auto fill = fill_factor(binary_final_square);
@@ -1375,7 +2232,7 @@ sudoku_grid split(const cv::Mat& source_image, cv::Mat& dest_image, const std::v
                     cv::Mat step_2;
                     cv::Mat step_3;
                     cv::cvtColor(step_1, step_2, CV_RGB2GRAY);
-                    cell_binarize(step_2, step_3, mixed);
+                    cell_binarize(step_2, step_3, mixed, sauvola);
 
                     //Make the image square
                     cv::Mat step_4(cv::Size(dim, dim), step_3.type());
@@ -1385,16 +2242,12 @@ sudoku_grid split(const cv::Mat& source_image, cv::Mat& dest_image, const std::v
                     cv::Mat step_5(cv::Size(CELL_SIZE, CELL_SIZE), step_4.type());
                     cv::resize(step_4, step_5, step_5.size(), 0, 0, cv::INTER_CUBIC);
 
-                    cell_binarize(step_5, cell.binary_mat, false);
+                    cell_binarize(step_5, cell.binary_mat, false, sauvola);
 
-                    //Resize the color and gray squares
-
-                    cv::resize(gray_final_square, cell.gray_mat, cell.gray_mat.size(), 0, 0, cv::INTER_CUBIC);
-                    cv::resize(color_final_square, cell.color_mat, cell.color_mat.size(), 0, 0, cv::INTER_CUBIC);
-
-                    //Save the bounding rect
+                    //Save the bounding rect, the color and gray squares are extracted on demand
 
                     cell.digit_bounding = big_rect;
+                    cell.m_digit = true;
 
                     if(SHOW_CHAR_CELLS){
                         cv::rectangle(dest_image, big_rect, cv::Scalar(255, 0, 0), 2);
@@ -1420,23 +2273,58 @@ sudoku_grid split(const cv::Mat& source_image, cv::Mat& dest_image, const std::v
     return grid;
 }
 
-sudoku_grid detect(const cv::Mat& source_image, cv::Mat& dest_image, bool mixed){
-    dest_image = source_image.clone();
+sudoku_grid detect(const cv::Mat& source_image, cv::Mat& dest_image, bool mixed, bool sauvola){
+    detection_context context(source_image, mixed, sauvola);
+    return detect(context, dest_image);
+}
+
+sudoku_grid detect(detection_context& context, cv::Mat& dest_image){
+    dest_image = context.source_image.clone();
+
+    detect_lines(context, dest_image);
+    detect_grid(context, dest_image);
+
+    return split(context, dest_image);
+}
+
+sudoku_grid detect_binary(const cv::Mat& source_image, cv::Mat& dest_image, bool /*mixed*/, bool sauvola){
+    //The binary image is used directly by the context
+    detection_context context(source_image, false, sauvola);
+    return detect(context, dest_image);
+}
+
+namespace detector_kernels {
+
+std::vector<cv::Vec4i> detect_segments(const cv::Mat& binary_image){
+    return ::detect_segments(binary_image);
+}
 
-    auto lines = detect_lines(source_image, dest_image, mixed);
-    auto cells = detect_grid(source_image, dest_image, lines, mixed);
+std::vector<std::vector<cv::Vec4i>> cluster_segments(const std::vector<cv::Vec4i>& segments, const cv::Mat& image){
+    return ::cluster_segments(segments, image);
+}
 
-    return split(source_image, dest_image, cells, lines, mixed);
+void merge_segments(std::vector<cv::Vec4i>& segments){
+    ::merge_segments(segments);
 }
 
-sudoku_grid detect_binary(const cv::Mat& source_image, cv::Mat& dest_image, bool mixed){
-    dest_image = source_image.clone();
+std::vector<cv::Point2f> find_intersections(const std::vector<line_t>& lines, const cv::Mat& image){
+    return ::find_intersections(lines, image);
+}
 
-    auto lines = detect_lines_binary(source_image, dest_image, mixed);
-    auto cells = detect_grid(source_image, dest_image, lines);
-    return split(source_image, dest_image, cells, lines);
+std::vector<std::vector<cv::Point2f>> cluster(const std::vector<cv::Point2f>& intersections){
+    return ::cluster(intersections);
 }
 
+std::vector<cv::Point2f> compute_hull(const std::vector<cv::Point2f>& points){
+    return ::compute_hull(points);
+}
+
+std::vector<cv::Rect> compute_grid(const std::vector<cv::Point2f>& hull, cv::Mat& dest_image){
+    return ::compute_grid(hull, dest_image);
+}
+
+} //end of namespace detector_kernels
+
 //TODO Order of the cells should really be unified
 std::ostream& operator<<(std::ostream& os, const sudoku_grid& grid){
     if(grid.valid()){
@@ -15,25 +15,54 @@
 #include "data.hpp"
 #include "solver.hpp"
 
-cv::Mat fill_image(const std::string& source, mnist_dataset_t& mnist_dataset, const std::vector<cv::Vec3b>& colors, bool write){
-    static std::random_device rd{};
-    static std::default_random_engine rand_engine{rd()};
+mnist_store::mnist_store(const mnist_dataset_t& dataset){
+    constexpr const std::size_t pixels_per_glyph = glyph_size * glyph_size;
 
-    static std::uniform_int_distribution<std::size_t> digit_distribution(0, mnist_size_1 + mnist_size_2);
-    static std::uniform_int_distribution<int> offset_distribution(-3, 3);
-    static std::uniform_int_distribution<std::size_t> color_distribution(0, n_colors - 1);
+    std::array<std::size_t, 10> counts;
+    counts.fill(0);
 
-    static auto digit_generator = std::bind(digit_distribution, rand_engine);
-    static auto offset_generator = std::bind(offset_distribution, rand_engine);
-    static auto color_generator = std::bind(color_distribution, rand_engine);
+    for(auto label : dataset.training_labels){
+        ++counts[label];
+    }
+
+    for(auto label : dataset.test_labels){
+        ++counts[label];
+    }
+
+    offsets[0] = 0;
+    for(std::size_t label = 0; label < 10; ++label){
+        offsets[label + 1] = offsets[label] + counts[label];
+    }
+
+    pixels.resize(offsets[10] * pixels_per_glyph);
+
+    //Next free glyph of each label
+    std::array<std::size_t, 10> next;
+    std::copy(offsets.begin(), offsets.begin() + 10, next.begin());
+
+    auto add = [&](const std::vector<std::vector<uint8_t>>& images, const std::vector<uint8_t>& labels){
+        for(std::size_t i = 0; i < images.size(); ++i){
+            std::copy(images[i].begin(), images[i].end(), pixels.begin() + next[labels[i]]++ * pixels_per_glyph);
+        }
+    };
 
-    std::cout << "Process image " << source << std::endl;
+    add(dataset.training_images, dataset.training_labels);
+    add(dataset.test_images, dataset.test_labels);
+}
+
+cv::Mat fill_image(const std::string& source, const mnist_store& store, const std::vector<cv::Vec3b>& colors, bool write, bool sauvola, fill_engine_t& rand_engine, std::ostream& out){
+    std::uniform_int_distribution<int> offset_distribution(-3, 3);
+    std::uniform_int_distribution<std::size_t> color_distribution(0, n_colors - 1);
+
+    auto offset_generator = [&](){ return offset_distribution(rand_engine); };
+
+    out << "Process image " << source << std::endl;
 
     auto source_image = open_image(source);
     auto original_image = open_image(source, false);
 
     if (!source_image.data || !original_image.data){
-        std::cout << "Invalid source_image" << std::endl;
+        out << "Invalid source_image" << std::endl;
         return original_image;
     }
 
@@ -48,10 +77,10 @@ cv::Mat fill_image(const std::string& source, mnist_dataset_t& mnist_dataset, co
     //Detect the grid/cells
 
     cv::Mat detect_dest_image;
-    auto grid = detect(source_image, detect_dest_image);
+    auto grid = detect(source_image, detect_dest_image, false, sauvola);
 
     if(!grid.valid()){
-        std::cout << "Invalid grid" << std::endl;
+        out << "Invalid grid" << std::endl;
     }
 
     //We use the ground truth to complete/fix the detection pass
@@ -59,7 +88,7 @@ cv::Mat fill_image(const std::string& source, mnist_dataset_t& mnist_dataset, co
     auto data = read_data(source);
 
     if(!data.valid){
-        std::cout << "The ground truth data is not valid" << std::endl;
+        out << "The ground truth data is not valid" << std::endl;
     }
 
     for(size_t i = 0; i < 9; ++i){
@@ -72,14 +101,14 @@ cv::Mat fill_image(const std::string& source, mnist_dataset_t& mnist_dataset, co
     }
 
     if(!is_valid(grid)){
-        std::cout << "The grid is not valid" << std::endl;
+        out << "The grid is not valid" << std::endl;
     }
 
     //Solve the grid (if it fails (bad detection/ground truth), random fill)
 
     if(!solve(grid)){
-        std::cout << "The grid is not solvable" << std::endl;
-        solve_random(grid);
+        out << "The grid is not solvable" << std::endl;
+        solve_random(grid, rand_engine);
     }
 
     //Update the ground truth
@@ -91,34 +120,23 @@ cv::Mat fill_image(const std::string& source, mnist_dataset_t& mnist_dataset, co
     }
 
     //Pick a random color for the whole sudoku
-    const auto& fill_color = colors[color_generator()];
+    const auto& fill_color = colors[color_distribution(rand_engine)];
 
     for(auto& cell : grid.cells){
         if(cell.empty()){
             auto& bounding_rect = cell.bounding;
 
-            //Note to self: This is pretty stupid (theoretical possible infinite loop)
-            auto r = digit_generator();
-            while(true){
-                auto label = r < mnist_size_1 ? mnist_dataset.training_labels[r] : mnist_dataset.test_labels[r - mnist_size_1];
+            //Get a random digit with the correct label from MNIST
 
-                if(label == cell.value()){
-                    break;
-                }
+            auto glyphs = store.size(cell.value());
 
-                r = digit_generator();
+            if(!glyphs){
+                continue;
             }
 
-            //Get the digit from MNIST
+            std::uniform_int_distribution<std::size_t> glyph_distribution(0, glyphs - 1);
 
-            auto image = r < mnist_size_1 ? mnist_dataset.training_images[r] : mnist_dataset.test_images[r - mnist_size_1];
-
-            cv::Mat image_mat(28, 28, CV_8U);
-            for(std::size_t xx = 0; xx < 28; ++xx){
-                for(std::size_t yy = 0; yy < 28; ++yy){
-                    image_mat.at<uchar>(cv::Point(xx, yy)) = image[yy * 28 + xx];
-                }
-            }
+            auto image_mat = store.glyph(cell.value(), glyph_distribution(rand_engine));
 
             //Center the digit inside the cell (plus some random offsets)
 
@@ -137,16 +155,13 @@ cv::Mat fill_image(const std::string& source, mnist_dataset_t& mnist_dataset, co
 
             //Draw the digit
 
-            for(int xx = 0; xx < image_mat.size().width; ++xx){
-                for(int yy = 0; yy < image_mat.size().height; ++yy){
-                    auto mnist_color = image_mat.at<uchar>(cv::Point(xx, yy));
-
-                    if(mnist_color > 40){
-                        auto& color = dest_image.at<cv::Vec3b>(cv::Point(xx + x_start, yy + y_start));
+            for(int yy = 0; yy < image_mat.rows; ++yy){
+                const auto* mnist_row = image_mat.ptr<uint8_t>(yy);
+                auto* dest_row = dest_image.ptr<cv::Vec3b>(yy + y_start) + x_start;
 
-                        color[0] = fill_color[0];
-                        color[1] = fill_color[1];
-                        color[2] = fill_color[2];
+                for(int xx = 0; xx < image_mat.cols; ++xx){
+                    if(mnist_row[xx] > 40){
+                        dest_row[xx] = fill_color;
                     }
                 }
             }
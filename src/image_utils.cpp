@@ -5,6 +5,10 @@
 //  http://opensource.org/licenses/MIT)
 //=======================================================================
 
+#include <fstream>
+
+#include "cpp_utils/assert.hpp"
+
 #include "image_utils.hpp"
 #include "detector.hpp" //For CELL_SIZE
 
@@ -14,29 +18,50 @@ float fill_factor(const cv::Mat& mat){
     return (static_cast<float>(non_zero) / area);
 }
 
-std::vector<double> mat_to_image(const cv::Mat& mat, bool gray){
-    std::vector<double> image(mat.rows * mat.cols);
+namespace {
 
-    for(std::size_t i = 0; i < static_cast<std::size_t>(mat.rows); ++i){
-        for(std::size_t j = 0; j < static_cast<std::size_t>(mat.cols); ++j){
-            auto value_c = static_cast<std::size_t>(mat.at<uint8_t>(i, j));
+template<typename T>
+void mat_to_image_impl(const cv::Mat& mat, T* image, bool gray){
+    const std::size_t cols = mat.cols;
 
-            if(gray){
-                image[i * mat.cols + j] = static_cast<double>(value_c);
-            } else {
-                assert(value_c == 0 || value_c == 255);
+    //Simple loops over the rows, vectorized by the compiler
+    for(int i = 0; i < mat.rows; ++i){
+        const auto* source = mat.ptr<uint8_t>(i);
+        auto* dest = image + i * cols;
 
-                image[i * mat.cols + j] = value_c == 0 ? 1.0 : 0.0;
+        if(gray){
+            for(std::size_t j = 0; j < cols; ++j){
+                dest[j] = source[j];
+            }
+        } else {
+            for(std::size_t j = 0; j < cols; ++j){
+                dest[j] = source[j] == 0 ? T(1) : T(0);
             }
         }
     }
+}
+
+} //end of anonymous namespace
+
+void mat_to_image(const cv::Mat& mat, float* image, bool gray){
+    mat_to_image_impl(mat, image, gray);
+}
+
+void mat_to_image(const cv::Mat& mat, double* image, bool gray){
+    mat_to_image_impl(mat, image, gray);
+}
+
+std::vector<double> mat_to_image(const cv::Mat& mat, bool gray){
+    std::vector<double> image(mat.rows * mat.cols);
+
+    mat_to_image_impl(mat, image.data(), gray);
 
     return image;
 }
 
-cv::Mat open_image(const std::string& path, bool resize){
-    auto source_image = cv::imread(path.c_str(), 1);
+namespace {
 
+cv::Mat downscale_image(cv::Mat source_image, bool resize){
     if (!source_image.data){
         return source_image;
     }
@@ -53,3 +78,96 @@ cv::Mat open_image(const std::string& path, bool resize){
 
     return source_image;
 }
+
+//Read the dimensions of a JPEG image from its SOF marker, without decoding it
+bool jpeg_size(const uint8_t* data, std::size_t size, cv::Size& image_size){
+    if(size < 4 || data[0] != 0xFF || data[1] != 0xD8){
+        return false;
+    }
+
+    std::size_t i = 2;
+    while(i + 4 <= size){
+        if(data[i] != 0xFF){
+            return false;
+        }
+
+        auto marker = data[i + 1];
+
+        //Fill byte
+        if(marker == 0xFF){
+            ++i;
+            continue;
+        }
+
+        //Markers without length
+        if(marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)){
+            i += 2;
+            continue;
+        }
+
+        //End of image or start of scan before any frame
+        if(marker == 0xD9 || marker == 0xDA){
+            return false;
+        }
+
+        //Start of frame markers (C4, C8 and CC are not frames)
+        if(marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC){
+            if(i + 9 > size){
+                return false;
+            }
+
+            image_size.height = (data[i + 5] << 8) | data[i + 6];
+            image_size.width  = (data[i + 7] << 8) | data[i + 8];
+
+            return image_size.width > 0 && image_size.height > 0;
+        }
+
+        i += 2 + ((data[i + 2] << 8) | data[i + 3]);
+    }
+
+    return false;
+}
+
+//Flag to decode the image directly at the smallest scale (1/2, 1/4 or 1/8)
+//that is still larger than the final size, the decoder then skips most of
+//the work. The small remaining resize is done by downscale_image.
+int decode_flag(const uint8_t* data, std::size_t size, bool resize){
+#if CV_MAJOR_VERSION > 3 || (CV_MAJOR_VERSION == 3 && CV_MINOR_VERSION >= 1)
+    cv::Size image_size;
+    if(resize && jpeg_size(data, size, image_size)){
+        //The decoder rounds the scaled dimensions up
+        auto largest = std::max(image_size.width, image_size.height);
+
+        if((largest + 7) / 8 >= 800){
+            return cv::IMREAD_REDUCED_COLOR_8;
+        } else if((largest + 3) / 4 >= 800){
+            return cv::IMREAD_REDUCED_COLOR_4;
+        } else if((largest + 1) / 2 >= 800){
+            return cv::IMREAD_REDUCED_COLOR_2;
+        }
+    }
+#else
+    cpp_unused(data);
+    cpp_unused(size);
+    cpp_unused(resize);
+#endif
+
+    return 1;
+}
+
+} //end of anonymous namespace
+
+cv::Mat open_image(const std::string& path, bool resize){
+    //The frame header is almost always in the first segments of the file
+    std::vector<uint8_t> header(128 * 1024);
+
+    std::ifstream stream(path, std::ios::binary);
+    stream.read(reinterpret_cast<char*>(header.data()), header.size());
+    header.resize(stream.gcount());
+
+    return downscale_image(cv::imread(path.c_str(), decode_flag(header.data(), header.size(), resize)), resize);
+}
+
+cv::Mat decode_image(const std::vector<uint8_t>& buffer, bool resize){
+    return downscale_image(cv::imdecode(buffer, decode_flag(buffer.data(), buffer.size(), resize)), resize);
+}
@@ -0,0 +1,69 @@
+//=======================================================================
+// Copyright Baptiste Wicht 2013-2015.
+// Distributed under the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include "sauvola.hpp"
+
+namespace {
+
+//Threshold a strip of rows. Thanks to the padding of the source image,
+//every window is complete and the window sums are computed without any
+//test on the borders.
+struct sauvola_body : cv::ParallelLoopBody {
+    const cv::Mat& gray_image;
+    const cv::Mat& sum;
+    const cv::Mat& sqsum;
+    cv::Mat& dest_image;
+
+    const int window;
+    const double k;
+    const double R;
+
+    sauvola_body(const cv::Mat& gray_image, const cv::Mat& sum, const cv::Mat& sqsum, cv::Mat& dest_image, int window, double k, double R)
+            : gray_image(gray_image), sum(sum), sqsum(sqsum), dest_image(dest_image), window(window), k(k), R(R) {}
+
+    void operator()(const cv::Range& range) const override {
+        const auto cols = gray_image.cols;
+        const double area = window * window;
+
+        for(int i = range.start; i < range.end; ++i){
+            const auto* source = gray_image.ptr<uint8_t>(i);
+            auto* dest = dest_image.ptr<uint8_t>(i);
+
+            const auto* s_top = sum.ptr<double>(i);
+            const auto* s_bottom = sum.ptr<double>(i + window);
+            const auto* q_top = sqsum.ptr<double>(i);
+            const auto* q_bottom = sqsum.ptr<double>(i + window);
+
+            for(int j = 0; j < cols; ++j){
+                auto s = s_bottom[j + window] - s_bottom[j] - s_top[j + window] + s_top[j];
+                auto q = q_bottom[j + window] - q_bottom[j] - q_top[j + window] + q_top[j];
+
+                dest[j] = source[j] > sauvola_threshold(s, q, area, k, R) ? 255 : 0;
+            }
+        }
+    }
+};
+
+} //end of anonymous namespace
+
+void sauvola_binarize(const cv::Mat& gray_image, cv::Mat& dest_image, int window, double k, double R){
+    const auto border = window / 2;
+    window = 2 * border + 1;
+
+    //Replicate the borders so that all the windows have the same area
+    cv::Mat padded;
+    cv::copyMakeBorder(gray_image, padded, border, border, border, border, cv::BORDER_REPLICATE);
+
+    cv::Mat sum;
+    cv::Mat sqsum;
+    cv::integral(padded, sum, sqsum, CV_64F);
+
+    dest_image.create(gray_image.size(), CV_8U);
+
+    //Each strip of rows is processed by one thread
+    cv::parallel_for_(cv::Range(0, gray_image.rows), sauvola_body(gray_image, sum, sqsum, dest_image, window, k, R), std::max(1, gray_image.rows / 64));
+}
@@ -6,104 +6,154 @@
 //=======================================================================
 
 #include <random>
-#include <functional>
 
 #include "solver.hpp"
 
 namespace {
 
-bool valid_move(const sudoku_grid& grid, std::size_t next_x, std::size_t next_y, std::size_t new_value){
-    //1. Ensure that there is not already this value on the row
-    for (std::size_t x = 0; x < 9; ++x){
-        if(x != next_x && grid(next_y, x).value() == new_value){
-            return false;
-        }
+constexpr const uint16_t ALL_DIGITS = 0x1FF;
+
+std::size_t row_of(std::size_t k){
+    return k / 9;
+}
+
+std::size_t column_of(std::size_t k){
+    return k % 9;
+}
+
+std::size_t box_of(std::size_t k){
+    return (k / 27) * 3 + (k % 9) / 3;
+}
+
+std::size_t popcount(uint16_t mask){
+    std::size_t count = 0;
+    for(; mask; mask &= mask - 1){
+        ++count;
     }
+    return count;
+}
 
-    //2. Ensure that there is not already this value on the column
-    for (std::size_t y = 0; y < 9; ++y){
-        if(y != next_y && grid(y, next_x).value() == new_value){
-            return false;
-        }
+//Index of the lowest digit of the mask (digit - 1)
+std::size_t lowest(uint16_t mask){
+    std::size_t i = 0;
+    while(!(mask & (1 << i))){
+        ++i;
     }
+    return i;
+}
 
-    //2. Ensure that there is not already this value in the box
-    for(std::size_t x = 0; x < 3; ++x){
-        for(std::size_t y = 0; y < 3; ++y){
-            std::size_t global_x = (next_x - next_x % 3) + x;
-            std::size_t global_y = (next_y - next_y % 3) + y;
+//The cells of the 27 units (9 rows, 9 columns and 9 boxes)
+using units_t = std::array<std::array<uint8_t, 9>, 27>;
 
-            if(!(global_x == next_x && global_y == next_y) && grid(global_y, global_x).value() == new_value){
-                return false;
-            }
-        }
+units_t make_units(){
+    units_t units;
+
+    for(std::size_t k = 0; k < 81; ++k){
+        units[row_of(k)][column_of(k)] = k;
+        units[9 + column_of(k)][row_of(k)] = k;
+        units[18 + box_of(k)][(row_of(k) % 3) * 3 + column_of(k) % 3] = k;
     }
 
-    return true;
+    return units;
 }
 
-bool next_empty_cell(const sudoku_grid& grid, std::size_t& next_x, std::size_t& next_y){
-    for(std::size_t x = 0; x < 9; ++x){
-        for(std::size_t y = 0; y < 9; ++y){
-            if(!grid(y, x).value()){
-                next_x = x;
-                next_y = y;
-                return true;
-            }
-        }
+const units_t units = make_units();
+
+//The board and the digits already used in each row, column and box (one
+//bit per digit). The state is small enough to be copied at each branch.
+struct solver_state {
+    sudoku_board board;
+    std::array<uint16_t, 9> rows;
+    std::array<uint16_t, 9> columns;
+    std::array<uint16_t, 9> boxes;
+
+    uint16_t candidates(std::size_t k) const {
+        return ALL_DIGITS & ~(rows[row_of(k)] | columns[column_of(k)] | boxes[box_of(k)]);
     }
 
-    return false;
-}
+    void place(std::size_t k, std::size_t digit){
+        uint16_t bit = 1 << (digit - 1);
 
+        board[k] = digit;
+        rows[row_of(k)] |= bit;
+        columns[column_of(k)] |= bit;
+        boxes[box_of(k)] |= bit;
+    }
 
-} //end of anonymous namespace
+    //Returns false if the clues are in conflict
+    bool init(const sudoku_board& source){
+        board.fill(0);
+        rows.fill(0);
+        columns.fill(0);
+        boxes.fill(0);
 
-bool is_valid(sudoku_grid& grid){
-    //Check all columns
-    for(std::size_t x = 0; x < 9; ++x){
-        for(std::size_t y = 0; y < 9; ++y){
-            //Don't test zero
-            if(grid(y, x).value()){
-                for(std::size_t yy = 0; yy < 9; ++yy){
-                    if(y != yy && grid(yy, x).value() == grid(y, x).value()){
-                        return false;
-                    }
+        for(std::size_t k = 0; k < 81; ++k){
+            if(source[k]){
+                if(source[k] > 9 || !(candidates(k) & (1 << (source[k] - 1)))){
+                    return false;
                 }
+
+                place(k, source[k]);
             }
         }
+
+        return true;
     }
+};
 
-    //Check all rows
-    for(std::size_t y = 0; y < 9; ++y){
-        for(std::size_t x = 0; x < 9; ++x){
-            //Don't test zero
-            if(grid(y, x).value()){
-                for(std::size_t xx = 0; xx < 9; ++xx){
-                    if(x != xx && grid(y, xx).value() == grid(y, x).value()){
-                        return false;
-                    }
+//Place the naked singles (cells with one candidate) and the hidden singles
+//(digits with one possible cell in a unit) until nothing changes. Returns
+//false if a cell has no candidate or a digit has no place in a unit.
+bool propagate(solver_state& state){
+    bool changed = true;
+
+    while(changed){
+        changed = false;
+
+        for(std::size_t k = 0; k < 81; ++k){
+            if(!state.board[k]){
+                auto mask = state.candidates(k);
+
+                if(!mask){
+                    return false;
+                }
+
+                if(!(mask & (mask - 1))){
+                    state.place(k, lowest(mask) + 1);
+                    changed = true;
                 }
             }
         }
-    }
 
-    //Check all squares
-    for(std::size_t x = 0; x < 3; ++x){
-        for(std::size_t y = 0; y < 3; ++y){
-            auto start_x = x * 3;
-            auto start_y = y * 3;
-
-            for(std::size_t xx = 0; xx < 3; ++xx){
-                for(std::size_t yy = 0; yy < 3; ++yy){
-                    if(grid(start_y + yy, start_x + xx).value()){
-                        for(std::size_t xxx = 0; xxx < 3; ++xxx){
-                            for(std::size_t yyy = 0; yyy < 3; ++yyy){
-                                if(!(xxx == xx && yyy == yy) && grid(start_y + yy, start_x + xx).value() == grid(start_y + yyy, start_x + xxx).value()){
-                                    return false;
-                                }
-                            }
-                        }
+        for(auto& unit : units){
+            uint16_t placed = 0;
+            uint16_t once = 0;
+            uint16_t twice = 0;
+
+            for(auto k : unit){
+                if(state.board[k]){
+                    placed |= 1 << (state.board[k] - 1);
+                } else {
+                    auto mask = state.candidates(k);
+                    twice |= once & mask;
+                    once |= mask;
+                }
+            }
+
+            if((placed | once) != ALL_DIGITS){
+                return false;
+            }
+
+            auto singles = once & ~twice & ~placed;
+
+            if(singles){
+                auto digit = lowest(singles);
+
+                for(auto k : unit){
+                    if(!state.board[k] && (state.candidates(k) & (1 << digit))){
+                        state.place(k, digit + 1);
+                        changed = true;
+                        break;
                     }
                 }
             }
@@ -113,37 +163,119 @@ bool is_valid(sudoku_grid& grid){
     return true;
 }
 
-bool solve(sudoku_grid& grid){
-    std::size_t x = 0;
-    std::size_t y = 0;
-
-    if(!next_empty_cell(grid, x, y)){
-        return true;
+//Explore the solutions reachable from the state. found(state) is called
+//with each complete solution and returns true to stop the search. Returns
+//true if the search has been stopped.
+template<typename Found>
+bool search(solver_state& state, Found&& found){
+    if(!propagate(state)){
+        return false;
     }
 
-    for(std::size_t new_value = 1; new_value < 10; ++new_value){
-        if(valid_move(grid, x, y, new_value)){
-            grid(y, x).value() = new_value;
-            if(solve(grid)){
-                return true;
+    //Branch on the empty cell with the fewest candidates
+    std::size_t best = 81;
+    std::size_t best_count = 10;
+
+    for(std::size_t k = 0; k < 81 && best_count > 2; ++k){
+        if(!state.board[k]){
+            auto count = popcount(state.candidates(k));
+
+            if(count < best_count){
+                best = k;
+                best_count = count;
             }
-            grid(y, x).value() = 0;
+        }
+    }
+
+    if(best == 81){
+        return found(state);
+    }
+
+    for(uint16_t mask = state.candidates(best); mask; mask &= mask - 1){
+        auto next = state;
+        next.place(best, lowest(mask) + 1);
+
+        if(search(next, found)){
+            return true;
         }
     }
 
     return false;
 }
 
-void solve_random(sudoku_grid& grid){
-    static std::random_device rd;
-    static std::default_random_engine rand_engine(rd());
-    static std::uniform_int_distribution<std::size_t> digit_distribution(1, 9);
-    static auto digit_generator = std::bind(digit_distribution, rand_engine);
+sudoku_board grid_board(const sudoku_grid& grid){
+    sudoku_board board;
+    for(std::size_t k = 0; k < 81; ++k){
+        board[k] = grid.cells[k].value();
+    }
+    return board;
+}
+
+} //end of anonymous namespace
+
+bool is_valid(const sudoku_board& board){
+    solver_state state;
+    return state.init(board);
+}
+
+bool is_valid(sudoku_grid& grid){
+    return grid.valid() && is_valid(grid_board(grid));
+}
+
+bool solve(sudoku_board& board){
+    solver_state state;
+
+    if(!state.init(board)){
+        return false;
+    }
+
+    return search(state, [&board](const solver_state& solution){
+        board = solution.board;
+        return true;
+    });
+}
+
+bool solve(sudoku_grid& grid){
+    if(!grid.valid()){
+        return false;
+    }
+
+    auto board = grid_board(grid);
+
+    if(!solve(board)){
+        return false;
+    }
+
+    for(std::size_t k = 0; k < 81; ++k){
+        grid.cells[k].value() = board[k];
+    }
+
+    return true;
+}
+
+std::size_t count_solutions(const sudoku_board& board, std::size_t limit){
+    solver_state state;
+
+    if(!limit || !state.init(board)){
+        return 0;
+    }
+
+    std::size_t count = 0;
+
+    search(state, [&count, limit](const solver_state&){
+        return ++count >= limit;
+    });
+
+    return count;
+}
+
+void solve_random(sudoku_grid& grid, std::mt19937& rand_engine){
+    std::uniform_int_distribution<std::size_t> digit_distribution(1, 9);
 
     for(std::size_t x = 0; x < 9; ++x){
         for(std::size_t y = 0; y < 9; ++y){
             if(!grid(y, x).value()){
-                grid(y, x).value() = digit_generator();
+                grid(y, x).value() = digit_distribution(rand_engine);
             }
         }
     }
@@ -6,21 +6,18 @@
 //=======================================================================
 
 #include <iostream>
+#include <sstream>
+#include <random>
 
 #include <opencv2/opencv.hpp>
 
 #include "cpp_utils/data.hpp"
 #include "cpp_utils/stop_watch.hpp"
 
-#define DLL_SVM_SUPPORT
+//Defines DLL_SVM_SUPPORT, must come before the other DLL headers
+#include "networks.hpp"
 
-#include "dll/rbm.hpp"
-#include "dll/conv_rbm.hpp"
-#include "dll/conv_rbm_mp.hpp"
-#include "dll/mp_layer.hpp"
 #include "dll/test.hpp"
-#include "dll/dbn.hpp"
-#include "dll/trainer/stochastic_gradient_descent.hpp"
 
 #include "mnist/mnist_reader.hpp"
 #include "mnist/mnist_utils.hpp"
@@ -31,6 +28,9 @@
 #include "image_utils.hpp"
 #include "utils.hpp"
 #include "fill.hpp"
+#include "pipeline.hpp"
+#include "batch.hpp"
+#include "solver.hpp"
 
 namespace {
 
@@ -39,200 +39,6 @@ const auto cdbn_mixed_model_file = "cdbn_mixed.dat";
 const auto dbn_mixed_model_file  = "dbn_mixed.dat";
 const auto cdbn_model_file       = "cdbn.dat";
 
-using mixed_dbn_pmp_t = dll::dbn_desc<
-    dll::dbn_layers<
-        dll::conv_rbm_mp_desc_square<1, CELL_SIZE, 30, 22, 2,
-            dll::weight_type<double>,
-            dll::momentum,
-            dll::weight_decay<dll::decay_type::L2>,
-            //dll::visible<dll::unit_type::GAUSSIAN>,
-            dll::sparsity<dll::sparsity_method::LEE>,
-            dll::batch_size<25>
-        >::layer_t,
-        dll::conv_rbm_mp_desc_square<30, 11, 30, 6, 2,
-            dll::weight_type<double>,
-            dll::momentum,
-            dll::weight_decay<dll::decay_type::L2>,
-            dll::sparsity<dll::sparsity_method::LEE>,
-            dll::batch_size<25>>::layer_t/*,
-        dll::conv_rbm_desc<10, 20, 6, 50, dll::momentum, dll::batch_size<25>>::layer_t*/
-    >, dll::batch_size<64>, /*dll::watcher<dll::opencv_dbn_visualizer>, */dll::svm_concatenate/*, dll::svm_scale*/>::dbn_t;
-
-using mixed_dbn_pmp_big_t = dll::dbn_desc<
-    dll::dbn_layers<
-        dll::conv_rbm_mp_desc_square<1, BIG_CELL_SIZE, 40, 32, 2,
-            dll::weight_type<double>,
-            dll::momentum,
-            dll::weight_decay<dll::decay_type::L2>,
-            //dll::visible<dll::unit_type::GAUSSIAN>,
-            dll::sparsity<dll::sparsity_method::LEE>,
-            dll::batch_size<25>
-        >::layer_t,
-        dll::conv_rbm_mp_desc_square<40, 16, 40, 10, 2,
-            dll::weight_type<double>,
-            dll::momentum,
-            dll::weight_decay<dll::decay_type::L2>,
-            dll::sparsity<dll::sparsity_method::LEE>,
-            dll::batch_size<25>>::layer_t/*,
-        dll::conv_rbm_desc<10, 20, 6, 50, dll::momentum, dll::batch_size<25>>::layer_t*/
-    >, dll::batch_size<64>, dll::svm_concatenate/*, dll::svm_scale*/>::dbn_t;
-
-using mixed_dbn_t = mixed_dbn_pmp_t;
-
-using dbn_t =
-    dll::dbn_desc<
-        dll::dbn_layers<
-            dll::rbm_desc<CELL_SIZE * CELL_SIZE, 500,
-                dll::momentum,
-                dll::shuffle,
-                dll::batch_size<32>,
-                dll::weight_decay<dll::decay_type::L2>,
-                dll::init_weights
-            >::layer_t,
-            dll::rbm_desc<500, 1000,
-                dll::momentum,
-                dll::shuffle,
-                dll::batch_size<32>,
-                dll::weight_decay<dll::decay_type::L2>
-            >::layer_t,
-            dll::rbm_desc<1000, 9,
-                dll::momentum,
-                dll::shuffle,
-                dll::batch_size<32>,
-                dll::weight_decay<dll::decay_type::L2>,
-                dll::hidden<dll::unit_type::SOFTMAX>
-            >::layer_t
-        >,
-        dll::trainer<dll::sgd_trainer>,
-        dll::batch_size<32>,
-        dll::momentum,
-        dll::shuffle,
-        //dll::verbose,
-        dll::weight_decay<dll::decay_type::L2>
-    >::dbn_t;
-
-using dbn_mixed_t =
-    dll::dbn_desc<
-        dll::dbn_layers<
-            dll::rbm_desc<CELL_SIZE * CELL_SIZE, 300,
-                dll::momentum,
-                dll::shuffle,
-                dll::batch_size<32>,
-                dll::weight_decay<dll::decay_type::L2>,
-                dll::hidden<dll::unit_type::BINARY>,
-                dll::init_weights
-            >::layer_t,
-            dll::rbm_desc<300, 300,
-                dll::momentum,
-                dll::shuffle,
-                dll::batch_size<32>,
-                dll::weight_decay<dll::decay_type::L2>,
-                dll::hidden<dll::unit_type::BINARY>
-            >::layer_t,
-            dll::rbm_desc<300, 9,
-                dll::momentum,
-                dll::shuffle,
-                dll::batch_size<32>,
-                dll::weight_decay<dll::decay_type::L2>,
-                dll::hidden<dll::unit_type::SOFTMAX>
-            >::layer_t
-        >,
-        dll::trainer<dll::sgd_trainer>,
-        dll::batch_size<32>,
-        dll::momentum,
-        dll::shuffle,
-        //dll::verbose,
-        dll::weight_decay<dll::decay_type::L2>
-    >::dbn_t;
-
-using cdbn_t =
-    dll::dbn_desc<
-        dll::dbn_layers<
-            dll::conv_rbm_desc<1, CELL_SIZE, CELL_SIZE, 4, 28, 28,
-                dll::weight_type<float>,
-                dll::momentum,
-                dll::shuffle,
-                dll::weight_decay<dll::decay_type::L2>,
-                dll::batch_size<32>,
-                dll::hidden<dll::unit_type::BINARY>
-            >::layer_t,
-            dll::mp_layer_3d_desc<4, 28, 28, 1, 2, 2, dll::weight_type<float>>::layer_t,
-            dll::conv_rbm_desc<4, 14, 14, 6, 10, 10,
-                dll::weight_type<float>,
-                dll::momentum,
-                dll::shuffle,
-                dll::weight_decay<dll::decay_type::L2>,
-                dll::batch_size<32>,
-                dll::hidden<dll::unit_type::BINARY>
-            >::layer_t,
-            dll::mp_layer_3d_desc<6, 10, 10, 1, 2, 2, dll::weight_type<float>>::layer_t,
-            dll::rbm_desc<6 * 5 * 5, 120,
-                dll::momentum,
-                dll::shuffle,
-                dll::weight_decay<dll::decay_type::L2>,
-                dll::batch_size<32>,
-                dll::hidden<dll::unit_type::BINARY>
-            >::layer_t,
-            dll::rbm_desc<120, 9,
-                dll::momentum,
-                dll::shuffle,
-                dll::batch_size<32>,
-                dll::weight_decay<dll::decay_type::L2>,
-                dll::hidden<dll::unit_type::SOFTMAX>
-            >::layer_t
-        >,
-        dll::trainer<dll::sgd_trainer>,
-        dll::batch_size<32>,
-        dll::momentum,
-        dll::shuffle,
-        dll::verbose,
-        dll::weight_decay<dll::decay_type::L2>
-    >::dbn_t;
-
-using cdbn_mixed_t =
-    dll::dbn_desc<
-        dll::dbn_layers<
-            dll::conv_rbm_desc<1, CELL_SIZE, CELL_SIZE, 6, 28, 28,
-                dll::weight_type<float>,
-                dll::momentum,
-                dll::shuffle,
-                dll::weight_decay<dll::decay_type::L2>,
-                dll::batch_size<32>,
-                dll::hidden<dll::unit_type::BINARY>
-            >::layer_t,
-            dll::mp_layer_3d_desc<6, 28, 28, 1, 2, 2, dll::weight_type<float>>::layer_t,
-            dll::conv_rbm_desc<6, 14, 14, 6, 10, 10,
-                dll::weight_type<float>,
-                dll::momentum,
-                dll::shuffle,
-                dll::weight_decay<dll::decay_type::L2>,
-                dll::batch_size<32>,
-                dll::hidden<dll::unit_type::BINARY>
-            >::layer_t,
-            dll::mp_layer_3d_desc<6, 10, 10, 1, 2, 2, dll::weight_type<float>>::layer_t,
-            dll::rbm_desc<6 * 5 * 5, 100,
-                dll::momentum,
-                dll::shuffle,
-                dll::weight_decay<dll::decay_type::L2>,
-                dll::batch_size<32>,
-                dll::hidden<dll::unit_type::BINARY>
-            >::layer_t,
-            dll::rbm_desc<100, 9,
-                dll::momentum,
-                dll::shuffle,
-                dll::batch_size<32>,
-                dll::weight_decay<dll::decay_type::L2>,
-                dll::hidden<dll::unit_type::SOFTMAX>
-            >::layer_t
-        >,
-        dll::trainer<dll::sgd_trainer>,
-        dll::batch_size<32>,
-        dll::momentum,
-        dll::shuffle,
-        dll::verbose,
-        dll::weight_decay<dll::decay_type::L2>
-    >::dbn_t;
-
 int command_detect(const config& conf){
     if(conf.files.empty()){
         std::cout << "Usage: sudoku detect <image>..." << std::endl;
@@ -241,29 +47,44 @@ int command_detect(const config& conf){
 
     bool view = conf.files.size() == 1 && conf.command != "detect_save";
 
-    for(auto image_source_path : conf.files){
-        std::cout << image_source_path << std::endl;
+    //Detection (and writing the result) is done by the workers, the
+    //messages are printed in input order
+
+    ordered_pipeline(conf.files.size(), conf.threads, [&conf, view](std::size_t n){
+        auto image_source_path = conf.files[n];
 
         auto source_image = open_image(image_source_path);
 
+        cv::Mat dest_image;
+
         if (!source_image.data){
-            std::cout << "Invalid source_image" << std::endl;
-            continue;
+            return dest_image;
         }
 
-        cv::Mat dest_image;
-        detect(source_image, dest_image, conf.mixed);
+        detection_context context(source_image, conf);
+        detect(context, dest_image);
+
+        if(!view){
+            image_source_path.insert(image_source_path.rfind('.'), ".lines");
+            imwrite(image_source_path.c_str(), dest_image);
+        }
+
+        return dest_image;
+    }, [&conf, view](std::size_t n, cv::Mat& dest_image){
+        std::cout << conf.files[n] << std::endl;
+
+        if (!dest_image.data){
+            std::cout << "Invalid source_image" << std::endl;
+            return;
+        }
 
         if(view){
             cv::namedWindow("Sudoku Grid", cv::WINDOW_AUTOSIZE);
             cv::imshow("Sudoku Grid", dest_image);
 
             cv::waitKey(0);
-        } else {
-            image_source_path.insert(image_source_path.rfind('.'), ".lines");
-            imwrite(image_source_path.c_str(), dest_image);
         }
-    }
+    });
 
     return 0;
 }
@@ -292,28 +113,51 @@ int command_fill(const config& conf){
         return -1;
     }
 
-    if(mnist_dataset.training_images.size() != mnist_size_1 || mnist_dataset.test_images.size() != mnist_size_2){
-        std::cout << "Constants mnist_size_1 and mnist_size_2 need to be updated!" << std::endl;
-        return -1;
-    }
-
     if(colors.size() != n_colors){
         std::cout << "Constant n_colors needs to be updated!" << std::endl;
         return -1;
     }
 
+    mnist_store store(mnist_dataset);
+
+    //Each image has its own random engine, seeded from the master seed
+    //and its position, the same seed and files generate the same images
+
+    std::uint64_t seed = conf.seed;
+    if(!seed){
+        seed = (std::uint64_t(std::random_device{}()) << 32) | std::random_device{}();
+    }
+
+    std::cout << "Seed: " << seed << std::endl;
+
     bool view = conf.files.size() == 1 && conf.command != "fill_save";
 
-    for(auto& image_source_path : conf.files){
-        auto dest_image = fill_image(image_source_path, mnist_dataset, colors, !view);
+    struct filled_image {
+        cv::Mat image;
+        std::string log;
+    };
+
+    ordered_pipeline(conf.files.size(), conf.threads, [&](std::size_t n){
+        std::seed_seq seq{std::uint32_t(seed), std::uint32_t(seed >> 32), std::uint32_t(n)};
+        fill_engine_t rand_engine(seq);
+
+        std::ostringstream log;
+
+        filled_image filled;
+        filled.image = fill_image(conf.files[n], store, colors, !view, conf.sauvola, rand_engine, log);
+        filled.log = log.str();
+
+        return filled;
+    }, [view](std::size_t, filled_image& filled){
+        std::cout << filled.log;
 
         if(view){
             cv::namedWindow("Sudoku Grid", cv::WINDOW_AUTOSIZE);
-            cv::imshow("Sudoku Grid", dest_image);
+            cv::imshow("Sudoku Grid", filled.image);
 
             cv::waitKey(0);
         }
-    }
+    });
 
     return 0;
 }
@@ -510,6 +354,111 @@ int command_train(const config& conf){
     return 0;
 }
 
+//The cells of the grid to classify, row by row, with their position
+//(i * 9 + j) in the grid. The empty cells are only classified in mixed
+//mode, there is nothing to recognize in them otherwise
+std::vector<const sudoku_cell*> grid_cells(const sudoku_grid& grid, bool mixed, std::vector<std::size_t>& positions){
+    std::vector<const sudoku_cell*> cells;
+    cells.reserve(81);
+
+    for(size_t i = 0; i < 9; ++i){
+        for(size_t j = 0; j < 9; ++j){
+            if(mixed || !grid(j, i).empty()){
+                cells.push_back(&grid(j, i));
+                positions.push_back(i * 9 + j);
+            }
+        }
+    }
+
+    return cells;
+}
+
+using recog_matrix_t = std::array<std::array<int, 9>, 9>;
+using recog_next_t = std::vector<std::tuple<std::size_t, std::size_t, double>>;
+
+void recog_grid(mixed_dbn_t& dbn, const sudoku_grid& grid, const config& conf, recog_matrix_t& matrix, recog_next_t& /*next*/){
+    for(size_t i = 0; i < 9; ++i){
+        for(size_t j = 0; j < 9; ++j){
+            static constexpr size_t W = mixed_dbn_t::layer_type<0>::NV1;
+            matrix[i][j] = dbn.svm_predict(grid(j, i).image_fast<W>(conf));
+        }
+    }
+}
+
+void recog_grid(dbn_t& dbn, const sudoku_grid& grid, const config& conf, recog_matrix_t& matrix, recog_next_t& next){
+    for(auto& row : matrix){
+        row.fill(0);
+    }
+
+    std::vector<std::size_t> positions;
+    auto cells = grid_cells(grid, false, positions);
+
+    if(cells.empty()){
+        return;
+    }
+
+    auto weights = batch_activation_probabilities(dbn, cells, conf);
+
+    for(std::size_t n = 0; n < cells.size(); ++n){
+        auto position = positions[n];
+        std::size_t answer = batch_label(weights, n) + 1;
+
+        for(std::size_t x = 0; x < 9; ++x){
+            if(answer != x + 1 && weights(n, x) > 1e-5){
+                next.push_back(std::make_tuple(position, x + 1, weights(n, x)));
+            }
+        }
+
+        matrix[position / 9][position % 9] = answer;
+    }
+}
+
+void print_empty_grid(std::ostream& os){
+    for(size_t i = 0; i < 9; ++i){
+        for(size_t j = 0; j < 9; ++j){
+            os << "0 ";
+        }
+        os << std::endl;
+    }
+}
+
+void print_recog(std::ostream& os, const recog_matrix_t& matrix, recog_next_t& next){
+    for(size_t i = 0; i < 9; ++i){
+        for(size_t j = 0; j < 9; ++j){
+            os << matrix[i][j] << " ";
+        }
+        os << std::endl;
+    }
+
+    if(!next.empty()){
+        std::sort(next.begin(), next.end(), [](auto& lhs, auto& rhs){
+            return std::get<2>(lhs) > std::get<2>(rhs);
+            });
+
+        for(std::size_t n = 0; n < next.size() && n < 5; ++n){
+            os << std::endl;
+
+            auto change = next[n];
+
+            for(size_t i = 0; i < 9; ++i){
+                for(size_t j = 0; j < 9; ++j){
+                    if(std::get<0>(change) == i * 9 + j){
+                        os << std::get<1>(change) << " ";
+                    } else {
+                        os << matrix[i][j] << " ";
+                    }
+                }
+                os << std::endl;
+            }
+        }
+    }
+}
+
+//0, 1 or many (count_solutions with a limit of 2)
+const char* solutions_status(std::size_t solutions){
+    return solutions == 0 ? "0" : solutions == 1 ? "1" : "many";
+}
+
 int command_recog(const config& conf){
     std::string image_source_path(conf.files.front());
 
@@ -537,7 +486,8 @@ int command_recog(const config& conf){
             return 1;
         }
 
-        grid = detect(source_image, dest_image, conf.mixed);
+        detection_context context(source_image, conf);
+        grid = detect(context, dest_image);
     } else if(conf.command == "recog_binary"){
         std::ifstream is(image_source_path);
 
@@ -590,90 +540,168 @@ int command_recog(const config& conf){
             ++i;
         }
 
-        grid = detect_binary(source_image, dest_image, conf.mixed);
+        grid = detect_binary(source_image, dest_image, conf.mixed, conf.sauvola);
     }
 
     if(!grid.valid()){
-        for(size_t i = 0; i < 9; ++i){
-            for(size_t j = 0; j < 9; ++j){
-                std::cout << "0 ";
-            }
-            std::cout << std::endl;
-        }
+        print_empty_grid(std::cout);
     } else {
-        std::vector<std::tuple<std::size_t, std::size_t, double>> next;
-
-        std::array<std::array<int, 9>, 9> matrix;
+        recog_next_t next;
+        recog_matrix_t matrix;
 
         if(conf.mixed){
             auto dbn = std::make_unique<mixed_dbn_t>();
             dbn->load(is);
 
-            for(size_t i = 0; i < 9; ++i){
-                for(size_t j = 0; j < 9; ++j){
-                    static constexpr size_t W = mixed_dbn_t::layer_type<0>::NV1;
-                    matrix[i][j] = dbn->svm_predict(grid(j, i).image_fast<W>(conf));
-                }
-            }
+            recog_grid(*dbn, grid, conf, matrix, next);
         } else {
             auto dbn = std::make_unique<dbn_t>();
             dbn->load(is);
 
-            for(size_t i = 0; i < 9; ++i){
-                for(size_t j = 0; j < 9; ++j){
-                    auto& cell = grid(j, i);
+            recog_grid(*dbn, grid, conf, matrix, next);
+        }
 
-                    std::size_t answer;
-                    if(cell.empty()){
-                        answer = 0;
-                    } else {
-                        auto weights = dbn->activation_probabilities(cell.image_1d<float>(conf));
-                        answer = dbn->predict_label(weights)+1;
-                        for(std::size_t x = 0; x < weights.size(); ++x){
-                            if(answer != x + 1 && weights(x) > 1e-5){
-                                next.push_back(std::make_tuple(i * 9 + j, x + 1, weights(x)));
-                            }
-                        }
-                    }
-                    matrix[i][j] = answer;
-                }
-            }
+        print_recog(std::cout, matrix, next);
+    }
+
+    return 0;
+}
+
+template<typename Net>
+int serve_network(const config& conf, Net& dbn){
+    //Protocol: one request per line on stdin, either an image path or
+    //"raw <n>" followed by n bytes of encoded image. Each answer is
+    //terminated by a line containing only "END". With -u, in standard
+    //mode, the recognized grid is followed by a line "SOLUTIONS 0|1|many".
+    //A raw image is at most max_raw_size bytes, an invalid size or a
+    //truncated image is answered by an ERROR and ends the session
+
+    constexpr const std::size_t max_raw_size = 64 * 1024 * 1024;
+
+    std::string line;
+    while(std::getline(std::cin, line)){
+        if(line.empty()){
+            continue;
         }
 
-        for(size_t i = 0; i < 9; ++i){
-            for(size_t j = 0; j < 9; ++j){
-                std::cout << matrix[i][j] << " ";
-            }
-            std::cout << std::endl;
+        if(line == "quit"){
+            break;
         }
 
-        if(!next.empty()){
-            std::sort(next.begin(), next.end(), [](auto& lhs, auto& rhs){
-                return std::get<2>(lhs) > std::get<2>(rhs);
-                });
+        cv::Mat source_image;
 
-            for(std::size_t n = 0; n < next.size() && n < 5; ++n){
-                std::cout << std::endl;
+        if(line.compare(0, 4, "raw ") == 0){
+            std::size_t size = 0;
+            std::istringstream size_stream(line.substr(4));
 
-                auto change = next[n];
+            //After a bad size or a short read, the rest of the input cannot
+            //be parsed anymore, the session is ended
+            if(!(size_stream >> size) || !size || size > max_raw_size){
+                std::cout << "ERROR Invalid raw size (at most " << max_raw_size << " bytes)" << std::endl;
+                std::cout << "END" << std::endl;
+                return 1;
+            }
 
-                for(size_t i = 0; i < 9; ++i){
-                    for(size_t j = 0; j < 9; ++j){
-                        if(std::get<0>(change) == i * 9 + j){
-                            std::cout << std::get<1>(change) << " ";
-                        } else {
-                            std::cout << matrix[i][j] << " ";
-                        }
+            std::vector<uint8_t> buffer(size);
+            if(!std::cin.read(reinterpret_cast<char*>(buffer.data()), size)){
+                std::cout << "ERROR Truncated raw image (" << std::cin.gcount() << "/" << size << " bytes)" << std::endl;
+                std::cout << "END" << std::endl;
+                return 1;
+            }
+
+            source_image = decode_image(buffer);
+        } else {
+            source_image = open_image(line);
+        }
+
+        if (!source_image.data){
+            std::cout << "ERROR Invalid source_image" << std::endl;
+        } else {
+            cv::Mat dest_image;
+            detection_context context(source_image, conf);
+            auto grid = detect(context, dest_image);
+
+            if(!grid.valid()){
+                print_empty_grid(std::cout);
+            } else {
+                recog_next_t next;
+                recog_matrix_t matrix;
+
+                recog_grid(dbn, grid, conf, matrix, next);
+
+                print_recog(std::cout, matrix, next);
+
+                //Sanity check of the recognition: a correct grid has exactly one
+                //solution. In mixed mode, all the cells get a digit, there is
+                //nothing to check
+                if(conf.unique && !conf.mixed){
+                    sudoku_board board;
+                    for(std::size_t k = 0; k < 81; ++k){
+                        board[k] = matrix[k / 9][k % 9];
                     }
-                    std::cout << std::endl;
+
+                    std::cout << "SOLUTIONS " << solutions_status(count_solutions(board, 2)) << std::endl;
                 }
             }
         }
+
+        std::cout << "END" << std::endl;
     }
 
     return 0;
 }
 
+int command_serve(const config& conf){
+    std::string dbn_path = conf.mixed ? "cdbn.dat" : "final.dat";
+    if(!conf.files.empty()){
+        dbn_path = conf.files.front();
+    }
+
+    std::ifstream is(dbn_path, std::ofstream::binary);
+    if(!is.is_open()){
+        std::cerr << dbn_path << " does not exist or is not readable" << std::endl;
+        return 1;
+    }
+
+    //The network is loaded only once for all the requests
+
+    if(conf.mixed){
+        auto dbn = std::make_unique<mixed_dbn_t>();
+        dbn->load(is);
+        std::cerr << "Load model from " << dbn_path << std::endl;
+
+        return serve_network(conf, *dbn);
+    } else {
+        auto dbn = std::make_unique<dbn_t>();
+        dbn->load(is);
+        std::cerr << "Load model from " << dbn_path << std::endl;
+
+        return serve_network(conf, *dbn);
+    }
+}
+
+//Classify the cells of all the grids of the dataset and give the
+//weights of each grid to check(i, weights), in grid order. The dense
+//networks are only read by the batches, so their grids are classified
+//on conf.threads threads. The other networks classify on the calling
+//thread.
+template<typename Net, typename Check>
+void classify_grids(Net& dbn, const config& conf, const dataset& ds, bool mixed, Check&& check){
+    const auto threads = is_dense_network<Net>::value ? conf.threads : 1;
+
+    ordered_pipeline(ds.source_grids.size(), threads, [&dbn, &conf, &ds, mixed](std::size_t i){
+        std::vector<std::size_t> positions;
+        auto cells = grid_cells(ds.source_grids[i], mixed, positions);
+
+        batch_t weights;
+        if(!cells.empty()){
+            weights = batch_activation_probabilities(dbn, cells, conf);
+        }
+
+        return weights;
+    }, std::forward<Check>(check));
+}
+
 template<typename Net>
 void standard_test_network(const Net& dbn, const config& conf, dataset& ds){
     std::cout << "Start testing in standard mode" << std::endl;
@@ -692,13 +720,16 @@ void standard_test_network(const Net& dbn, const config& conf, dataset& ds){
     size_t zero_errors = 0;
     size_t dbn_errors = 0;
 
-    for(std::size_t i = 0; i < ds.source_grids.size(); ++i){
-        const auto& grid = ds.source_grids[i];
+    //Only the non-empty cells are classified, row by row
+    classify_grids(*dbn, conf, ds, false, [&](std::size_t g, batch_t& weights){
+        const auto& grid = ds.source_grids[g];
 
         std::cout << grid.source_image_path << std::endl;
 
         std::size_t local_hits = 0;
 
+        std::size_t n = 0;
+
         for(size_t i = 0; i < 9; ++i){
             for(size_t j = 0; j < 9; ++j){
                 uint8_t answer;
@@ -706,11 +737,13 @@ void standard_test_network(const Net& dbn, const config& conf, dataset& ds){
                 auto& cell_mat = cell.mat(conf);
                 auto correct = cell.correct();
 
-                auto weights = dbn->activation_probabilities(cell.image_1d<float>(conf));
+                //Row of the cell in the batch
+                std::size_t row = n;
+
                 if(cell.empty()){
                     answer = 0;
                 } else {
-                    answer = dbn->predict_label(weights)+1;
+                    answer = batch_label(weights, n++)+1;
                 }
 
                 if(answer == correct){
@@ -729,14 +762,16 @@ void standard_test_network(const Net& dbn, const config& conf, dataset& ds){
                         std::cout << "\t was: " << static_cast<size_t>(correct) << std::endl;
                         std::cout << "\t fill_factor: " << fill_factor(cell_mat) << std::endl;
 
-                        std::cout << "\t weights: {";
-                        for(std::size_t i = 0; i < weights.size(); ++i){
-                            if(i > 0){
-                                std::cout << ",";
+                        if(!cell.empty()){
+                            std::cout << "\t weights: {";
+                            for(std::size_t x = 0; x < 9; ++x){
+                                if(x > 0){
+                                    std::cout << ",";
+                                }
+                                std::cout << weights(row, x);
                             }
-                            std::cout << weights[i];
+                            std::cout << "}" << std::endl;
                         }
-                        std::cout << "}" << std::endl;
                     }
                 }
             }
@@ -747,7 +782,7 @@ void standard_test_network(const Net& dbn, const config& conf, dataset& ds){
         }
 
         cell_hits += local_hits;
-    }
+    });
 
     auto total_s = static_cast<double>(ds.source_grids.size());
     auto total_c = total_s * 81.0;
@@ -779,8 +814,8 @@ void mixed_test_network(const Net& dbn, const config& conf, dataset& ds){
     size_t cell_hits = 0;
     size_t dbn_errors = 0;
 
-    for(std::size_t i = 0; i < ds.source_grids.size(); ++i){
-        const auto& grid = ds.source_grids[i];
+    classify_grids(*dbn, conf, ds, true, [&](std::size_t g, batch_t& weights){
+        const auto& grid = ds.source_grids[g];
 
         std::cout << grid.source_image_path << std::endl;
 
@@ -791,8 +826,7 @@ void mixed_test_network(const Net& dbn, const config& conf, dataset& ds){
                 uint8_t answer;
                 auto correct = grid(j,i).correct();
 
-                auto weights = dbn->activation_probabilities(grid(j,i).image_1d<float>(conf));
-                answer = dbn->predict_label(weights)+1;
+                answer = batch_label(weights, i * 9 + j)+1;
 
                 if(answer == correct){
                     ++local_hits;
@@ -806,11 +840,11 @@ void mixed_test_network(const Net& dbn, const config& conf, dataset& ds){
                         std::cout << "\t was: " << static_cast<size_t>(correct) << std::endl;
 
                         std::cout << "\t weights: {";
-                        for(std::size_t i = 0; i < weights.size(); ++i){
-                            if(i > 0){
+                        for(std::size_t x = 0; x < 9; ++x){
+                            if(x > 0){
                                 std::cout << ",";
                             }
-                            std::cout << weights[i];
+                            std::cout << weights(i * 9 + j, x);
                         }
                         std::cout << "}" << std::endl;
                     }
@@ -823,7 +857,7 @@ void mixed_test_network(const Net& dbn, const config& conf, dataset& ds){
         }
 
         cell_hits += local_hits;
-    }
+    });
 
     auto total_s = static_cast<double>(ds.source_grids.size());
     auto total_c = total_s * 81.0;
@@ -889,232 +923,196 @@ int command_test(const config& conf){
     return 0;
 }
 
+//Classify the cells of a grid, only used for timing
 template<typename Net>
-int time_network(const config& conf, Net& dbn){
-    {
-        //1. Image loading
+void recognize_cells(Net& dbn, sudoku_grid& grid, const config& conf){
+    std::vector<std::size_t> positions;
+    auto cells = grid_cells(grid, conf.mixed, positions);
 
-        std::vector<double> il_sum;
+    if(!cells.empty()){
+        auto weights = batch_activation_probabilities(dbn, cells, conf);
 
-        for(auto& image_source_path : conf.files){
-            open_image(image_source_path);
+        for(std::size_t n = 0; n < cells.size(); ++n){
+            grid.cells[positions[n]].value() = batch_label(weights, n) + 1;
         }
-
-        for(auto& image_source_path : conf.files){
-            cpp::stop_watch<std::chrono::microseconds> il_watch;
-
-            open_image(image_source_path);
-
-            il_sum.push_back(il_watch.elapsed());
-        }
-
-        std::cout << "Image loading: " << std::endl;
-        std::cout << "\tmin: " << min(il_sum) << std::endl;
-        std::cout << "\tmax: " << max(il_sum) << std::endl;
-        std::cout << "\tmean: " << mean(il_sum) << std::endl;
-        std::cout << "\tmedian: " << median(il_sum) << std::endl;
     }
+}
 
-    {
-        //2. Line detection
-
-        std::vector<double> ld_sum;
-
-        for(auto& image_source_path : conf.files){
-            auto source_image = open_image(image_source_path);
-            auto dest_image = source_image.clone();
-            detect_lines(source_image, dest_image, conf.mixed);
-        }
+constexpr const std::size_t time_stages = 9;
 
-        for(auto& image_source_path : conf.files){
-            auto source_image = open_image(image_source_path);
+const char* time_stage_names[time_stages] = {"decode", "draw", "binarize", "lines", "grid", "split", "classify", "solve", "total"};
 
-            cpp::stop_watch<std::chrono::microseconds> ld_watch;
+using time_samples = std::array<std::vector<double>, time_stages>;
 
-            auto dest_image = source_image.clone();
-            detect_lines(source_image, dest_image, conf.mixed);
+//Add the duration of its scope (in microseconds) to the samples
+struct stage_timer {
+    std::vector<double>& samples;
+    cpp::stop_watch<std::chrono::microseconds> watch;
 
-            ld_sum.push_back(ld_watch.elapsed());
-        }
+    explicit stage_timer(std::vector<double>& samples) : samples(samples) {}
 
-        std::cout << "Line Detection: " << std::endl;
-        std::cout << "\tmin: " << min(ld_sum) << std::endl;
-        std::cout << "\tmax: " << max(ld_sum) << std::endl;
-        std::cout << "\tmean: " << mean(ld_sum) << std::endl;
-        std::cout << "\tmedian: " << median(ld_sum) << std::endl;
+    ~stage_timer(){
+        samples.push_back(watch.elapsed());
     }
+};
+
+//Run the complete pipeline once on the image, each stage working on the
+//results of the previous one. Nothing is recorded if the image cannot be
+//decoded. The copy of the image the detection draws on is its own stage,
+//the detection stages only draw with the SHOW_ constants of the detector
+//(all off, they are for debugging)
+template<typename Net>
+bool time_pipeline(const config& conf, Net& dbn, const std::string& image_source_path, time_samples& samples){
+    time_samples run;
 
     {
-        //2. Grid detection
+        stage_timer total(run[8]);
 
-        std::vector<double> gd_sum;
+        cv::Mat source_image;
 
-        for(auto& image_source_path : conf.files){
-            auto source_image = open_image(image_source_path);
-            auto dest_image = source_image.clone();
-            auto lines = detect_lines(source_image, dest_image, conf.mixed);
-            detect_grid(source_image, dest_image, lines, conf.mixed);
+        {
+            stage_timer timer(run[0]);
+            source_image = open_image(image_source_path);
         }
 
-        for(auto& image_source_path : conf.files){
-            auto source_image = open_image(image_source_path);
-            auto dest_image = source_image.clone();
-            auto lines = detect_lines(source_image, dest_image, conf.mixed);
-
-            cpp::stop_watch<std::chrono::microseconds> gd_watch;
-
-            detect_grid(source_image, dest_image, lines, conf.mixed);
-
-            gd_sum.push_back(gd_watch.elapsed());
+        if(!source_image.data){
+            return false;
         }
 
-        std::cout << "Grid Detection: " << std::endl;
-        std::cout << "\tmin: " << min(gd_sum) << std::endl;
-        std::cout << "\tmax: " << max(gd_sum) << std::endl;
-        std::cout << "\tmean: " << mean(gd_sum) << std::endl;
-        std::cout << "\tmedian: " << median(gd_sum) << std::endl;
-    }
+        detection_context context(source_image, conf);
+        cv::Mat dest_image;
 
-    {
-        //3. Digit Detection
+        {
+            stage_timer timer(run[1]);
+            dest_image = source_image.clone();
+        }
 
-        std::vector<double> dd_sum;
+        {
+            stage_timer timer(run[2]);
+            context.binary();
+        }
 
-        for(auto& image_source_path : conf.files){
-            auto source_image = open_image(image_source_path);
-            auto dest_image = source_image.clone();
-            auto lines = detect_lines(source_image, dest_image, conf.mixed);
-            auto cells = detect_grid(source_image, dest_image, lines, conf.mixed);
-            split(source_image, dest_image, cells, lines, conf.mixed);
+        {
+            stage_timer timer(run[3]);
+            detect_lines(context, dest_image);
         }
 
-        for(auto& image_source_path : conf.files){
-            auto source_image = open_image(image_source_path);
-            auto dest_image = source_image.clone();
-            auto lines = detect_lines(source_image, dest_image, conf.mixed);
-            auto cells = detect_grid(source_image, dest_image, lines, conf.mixed);
+        {
+            stage_timer timer(run[4]);
+            detect_grid(context, dest_image);
+        }
 
-            cpp::stop_watch<std::chrono::microseconds> dd_watch;
+        sudoku_grid grid;
 
-            split(source_image, dest_image, cells, lines, conf.mixed);
+        {
+            stage_timer timer(run[5]);
+            grid = split(context, dest_image);
+        }
 
-            dd_sum.push_back(dd_watch.elapsed());
+        {
+            stage_timer timer(run[6]);
+            recognize_cells(*dbn, grid, conf);
         }
 
-        std::cout << "Digit Detection: " << std::endl;
-        std::cout << "\tmin: " << min(dd_sum) << std::endl;
-        std::cout << "\tmax: " << max(dd_sum) << std::endl;
-        std::cout << "\tmean: " << mean(dd_sum) << std::endl;
-        std::cout << "\tmedian: " << median(dd_sum) << std::endl;
+        {
+            stage_timer timer(run[7]);
+            solve(grid);
+        }
     }
 
-    {
-        //4. Digit Recognition
-
-        std::vector<double> dr_sum;
-
-        for(auto& image_source_path : conf.files){
-            auto source_image = open_image(image_source_path);
-            auto dest_image = source_image.clone();
-            auto lines = detect_lines(source_image, dest_image, conf.mixed);
-            auto cells = detect_grid(source_image, dest_image, lines, conf.mixed);
-            auto image = split(source_image, dest_image, cells, lines, conf.mixed);
-
-            for(size_t i = 0; i < 9; ++i){
-                for(size_t j = 0; j < 9; ++j){
-                    uint8_t answer;
+    for(std::size_t s = 0; s < time_stages; ++s){
+        samples[s].insert(samples[s].end(), run[s].begin(), run[s].end());
+    }
 
-                    auto& cell = image(i, j);
+    return true;
+}
 
-                    if(!conf.mixed && cell.empty()){
-                        answer = 0;
-                    } else {
-                        auto weights = dbn->activation_probabilities(cell.image_1d<float>(conf));
-                        answer = dbn->predict_label(weights)+1;
-                    }
+void print_time_samples(const config& conf, std::size_t images, time_samples& samples){
+    if(conf.format == "csv"){
+        std::cout << "stage,samples,min,mean,p50,p90,p99,max" << std::endl;
+    } else if(conf.format == "json"){
+        std::cout << "{\"unit\": \"us\", \"images\": " << images
+                  << ", \"warmup\": " << conf.warmup << ", \"repeat\": " << conf.repeat << ", \"stages\": [" << std::endl;
+    }
 
-                    cpp_unused(answer);
-                }
-            }
+    for(std::size_t s = 0; s < time_stages; ++s){
+        auto& sum = samples[s];
+        std::sort(sum.begin(), sum.end());
+
+        auto p50 = sorted_percentile(sum, 50);
+        auto p90 = sorted_percentile(sum, 90);
+        auto p99 = sorted_percentile(sum, 99);
+
+        if(conf.format == "csv"){
+            std::cout << time_stage_names[s] << "," << sum.size() << "," << min(sum) << "," << mean(sum)
+                      << "," << p50 << "," << p90 << "," << p99 << "," << max(sum) << std::endl;
+        } else if(conf.format == "json"){
+            std::cout << "  {\"name\": \"" << time_stage_names[s] << "\", \"samples\": " << sum.size()
+                      << ", \"min\": " << min(sum) << ", \"mean\": " << mean(sum)
+                      << ", \"p50\": " << p50 << ", \"p90\": " << p90 << ", \"p99\": " << p99
+                      << ", \"max\": " << max(sum) << "}" << (s + 1 < time_stages ? "," : "") << std::endl;
+        } else {
+            std::cout << time_stage_names[s] << ": " << std::endl;
+            std::cout << "\tmin: " << min(sum) << std::endl;
+            std::cout << "\tmean: " << mean(sum) << std::endl;
+            std::cout << "\tp50: " << p50 << std::endl;
+            std::cout << "\tp90: " << p90 << std::endl;
+            std::cout << "\tp99: " << p99 << std::endl;
+            std::cout << "\tmax: " << max(sum) << std::endl;
         }
+    }
 
-        for(auto& image_source_path : conf.files){
-            auto source_image = open_image(image_source_path);
-            auto dest_image = source_image.clone();
-            auto lines = detect_lines(source_image, dest_image, conf.mixed);
-            auto cells = detect_grid(source_image, dest_image, lines, conf.mixed);
-            auto image = split(source_image, dest_image, cells, lines, conf.mixed);
-
-            cpp::stop_watch<std::chrono::microseconds> dr_watch;
+    if(conf.format == "json"){
+        std::cout << "]}" << std::endl;
+    }
+}
 
-            for(size_t i = 0; i < 9; ++i){
-                for(size_t j = 0; j < 9; ++j){
-                    uint8_t answer;
+template<typename Net>
+int time_network(const config& conf, Net& dbn){
+    if(conf.files.empty()){
+        std::cerr << "time needs at least one image" << std::endl;
+        return 1;
+    }
 
-                    auto& cell = image(i, j);
+    if(conf.format != "text" && conf.format != "csv" && conf.format != "json"){
+        std::cerr << "Unknown format " << conf.format << " (text, csv or json)" << std::endl;
+        return 1;
+    }
 
-                    if(!conf.mixed && cell.empty()){
-                        answer = 0;
-                    } else {
-                        auto weights = dbn->activation_probabilities(cell.image_1d<float>(conf));
-                        answer = dbn->predict_label(weights)+1;
-                    }
+    //The images that cannot be decoded are reported on their first run
+    //and skipped by the next ones, they are never part of the measures
+    std::vector<bool> invalid(conf.files.size(), false);
 
-                    cpp_unused(answer);
-                }
+    auto run_all = [&](time_samples& samples){
+        for(std::size_t n = 0; n < conf.files.size(); ++n){
+            if(!invalid[n] && !time_pipeline(conf, dbn, conf.files[n], samples)){
+                invalid[n] = true;
+                std::cerr << "Invalid source_image " << conf.files[n] << ", skipped" << std::endl;
             }
-
-            dr_sum.push_back(dr_watch.elapsed());
         }
+    };
 
-        std::cout << "Digit Recognition: " << std::endl;
-        std::cout << "\tmin: " << min(dr_sum) << std::endl;
-        std::cout << "\tmax: " << max(dr_sum) << std::endl;
-        std::cout << "\tmean: " << mean(dr_sum) << std::endl;
-        std::cout << "\tmedian: " << median(dr_sum) << std::endl;
+    //The warm-up runs are not part of the measures
+    for(std::size_t r = 0; r < conf.warmup; ++r){
+        time_samples ignored;
+        run_all(ignored);
     }
 
-    {
-        //5. Total
-
-        std::vector<double> tot_sum;
-
-        for(auto& image_source_path : conf.files){
-            cpp::stop_watch<std::chrono::microseconds> tot_watch;
-
-            auto source_image = open_image(image_source_path);
-            auto dest_image = source_image.clone();
-            auto lines = detect_lines(source_image, dest_image, conf.mixed);
-            auto cells = detect_grid(source_image, dest_image, lines, conf.mixed);
-            auto image = split(source_image, dest_image, cells, lines, conf.mixed);
-
-            for(size_t i = 0; i < 9; ++i){
-                for(size_t j = 0; j < 9; ++j){
-                    uint8_t answer;
-
-                    auto& cell = image(i,j);
-
-                    if(!conf.mixed && cell.empty()){
-                        answer = 0;
-                    } else {
-                        auto weights = dbn->activation_probabilities(cell.image_1d<float>(conf));
-                        answer = dbn->predict_label(weights)+1;
-                    }
+    time_samples samples;
 
-                    cpp_unused(answer);
-                }
-            }
+    for(std::size_t r = 0; r < conf.repeat; ++r){
+        run_all(samples);
+    }
 
-            tot_sum.push_back(tot_watch.elapsed());
-        }
+    std::size_t images = std::count(invalid.begin(), invalid.end(), false);
 
-        std::cout << "Total: " << std::endl;
-        std::cout << "\tmin: " << min(tot_sum) << std::endl;
-        std::cout << "\tmax: " << max(tot_sum) << std::endl;
-        std::cout << "\tmean: " << mean(tot_sum) << std::endl;
-        std::cout << "\tmedian: " << median(tot_sum) << std::endl;
+    if(!images){
+        std::cerr << "No valid image to time" << std::endl;
+        return 1;
     }
 
+    print_time_samples(conf, images, samples);
+
     return 0;
 }
 
@@ -1125,7 +1123,7 @@ int command_time(const config& conf){
 
             std::ifstream is(dbn_mixed_model_file, std::ofstream::binary);
             dbn->load(is);
-            std::cout << "Load model from " << dbn_mixed_model_file << std::endl;
+            std::cerr << "Load model from " << dbn_mixed_model_file << std::endl;
 
             return time_network(conf, dbn);
         } else {
@@ -1133,7 +1131,7 @@ int command_time(const config& conf){
 
             std::ifstream is(cdbn_mixed_model_file, std::ofstream::binary);
             cdbn->load(is);
-            std::cout << "Load model from " << cdbn_mixed_model_file << std::endl;
+            std::cerr << "Load model from " << cdbn_mixed_model_file << std::endl;
 
             return time_network(conf, cdbn);
         }
@@ -1143,7 +1141,7 @@ int command_time(const config& conf){
 
             std::ifstream is(dbn_model_file, std::ofstream::binary);
             dbn->load(is);
-            std::cout << "Load model from " << dbn_model_file << std::endl;
+            std::cerr << "Load model from " << dbn_model_file << std::endl;
 
             return time_network(conf, dbn);
         } else {
@@ -1151,13 +1149,219 @@ int command_time(const config& conf){
 
             std::ifstream is(cdbn_model_file, std::ofstream::binary);
             cdbn->load(is);
-            std::cout << "Load model from " << cdbn_model_file << std::endl;
+            std::cerr << "Load model from " << cdbn_model_file << std::endl;
 
             return time_network(conf, cdbn);
         }
     }
 }
 
+//Parse a puzzle in the 81 characters format ('0' or '.' for the empty cells)
+bool parse_puzzle(const std::string& line, sudoku_board& board){
+    if(line.size() < 81){
+        return false;
+    }
+
+    for(std::size_t k = 0; k < 81; ++k){
+        auto c = line[k];
+
+        if(c == '.' || c == '0'){
+            board[k] = 0;
+        } else if(c >= '1' && c <= '9'){
+            board[k] = c - '0';
+        } else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+std::string board_string(const sudoku_board& board){
+    std::string line(81, '0');
+
+    for(std::size_t k = 0; k < 81; ++k){
+        line[k] = '0' + board[k];
+    }
+
+    return line;
+}
+
+//Read the next puzzles of the inputs, at most max lines, returns false
+//when all the inputs are exhausted
+bool read_puzzles(std::vector<std::istream*>& inputs, std::size_t& current, std::vector<std::string>& lines, std::size_t max){
+    lines.clear();
+
+    std::string line;
+    while(current < inputs.size() && lines.size() < max){
+        if(!std::getline(*inputs[current], line)){
+            ++current;
+            continue;
+        }
+
+        if(!line.empty() && line[0] != '#'){
+            lines.push_back(line);
+        }
+    }
+
+    return !lines.empty();
+}
+
+int command_solve(const config& conf){
+    //1. Open the inputs (stdin if there is no file or for "-"), the
+    //puzzles are read lazily, chunk by chunk
+
+    std::vector<std::unique_ptr<std::ifstream>> files;
+    std::vector<std::istream*> inputs;
+
+    if(conf.files.empty()){
+        inputs.push_back(&std::cin);
+    }
+
+    for(auto& file : conf.files){
+        if(file == "-"){
+            inputs.push_back(&std::cin);
+        } else {
+            files.push_back(std::make_unique<std::ifstream>(file));
+
+            if(!*files.back()){
+                std::cerr << "Impossible to read " << file << std::endl;
+                return 1;
+            }
+
+            inputs.push_back(files.back().get());
+        }
+    }
+
+    //2. Solve chunks of puzzles in parallel, the solutions are printed in input order
+
+    constexpr const std::size_t chunk_size = 256;
+    constexpr const std::size_t buckets = 32;
+
+    struct solved_chunk {
+        std::string output;
+        std::array<std::size_t, buckets> histogram;
+        std::size_t puzzles = 0;
+        std::size_t solved = 0;
+        std::size_t unique = 0;
+        std::size_t invalid = 0;
+    };
+
+    std::array<std::size_t, buckets> histogram;
+    histogram.fill(0);
+
+    std::size_t puzzles = 0;
+    std::size_t solved = 0;
+    std::size_t unique = 0;
+    std::size_t invalid = 0;
+
+    std::size_t current = 0;
+
+    cpp::stop_watch<std::chrono::microseconds> watch;
+
+    ordered_stream_pipeline<std::vector<std::string>>(conf.threads, [&](std::vector<std::string>& lines){
+        return read_puzzles(inputs, current, lines, chunk_size);
+    }, [&conf](std::vector<std::string>& lines){
+        solved_chunk chunk;
+        chunk.histogram.fill(0);
+
+        sudoku_board board;
+
+        for(auto& line : lines){
+            if(!parse_puzzle(line, board)){
+                ++chunk.invalid;
+                chunk.output += "invalid\n";
+                continue;
+            }
+
+            ++chunk.puzzles;
+
+            cpp::stop_watch<std::chrono::nanoseconds> puzzle_watch;
+
+            //In unique mode, the number of solutions is printed instead of the solution
+            bool result;
+            std::size_t solutions = 0;
+            if(conf.unique){
+                solutions = count_solutions(board, 2);
+                result = solutions > 0;
+            } else {
+                result = solve(board);
+            }
+
+            //Power of two buckets of microseconds, [0,1), [1,2), [2,4), ...
+            auto us = static_cast<std::size_t>(puzzle_watch.elapsed() / 1000.0);
+
+            std::size_t bucket = 0;
+            for(; us && bucket + 1 < buckets; us >>= 1){
+                ++bucket;
+            }
+
+            ++chunk.histogram[bucket];
+
+            if(conf.unique){
+                chunk.solved += result;
+                chunk.unique += solutions == 1;
+                chunk.output += solutions_status(solutions);
+                chunk.output += '\n';
+            } else if(result){
+                ++chunk.solved;
+                chunk.output += board_string(board);
+                chunk.output += '\n';
+            } else {
+                chunk.output += "unsolvable\n";
+            }
+        }
+
+        return chunk;
+    }, [&](std::size_t, solved_chunk& chunk){
+        if(!conf.quiet){
+            std::cout << chunk.output << std::flush;
+        }
+
+        for(std::size_t b = 0; b < buckets; ++b){
+            histogram[b] += chunk.histogram[b];
+        }
+
+        puzzles += chunk.puzzles;
+        solved += chunk.solved;
+        unique += chunk.unique;
+        invalid += chunk.invalid;
+    });
+
+    auto elapsed = watch.elapsed();
+
+    //3. Statistics (on stderr, the solutions can be piped)
+
+    //The invalid lines are not puzzles, they are not part of the throughput
+    std::cerr << puzzles << " puzzles, " << solved << " solved" << std::endl;
+
+    if(invalid){
+        std::cerr << invalid << " invalid lines" << std::endl;
+    }
+
+    if(conf.unique){
+        std::cerr << unique << " puzzles with a unique solution" << std::endl;
+    }
+    std::cerr << "Time: " << elapsed / 1000.0 << "ms (" << conf.threads << " threads)" << std::endl;
+
+    if(elapsed > 0){
+        std::cerr << "Throughput: " << puzzles * 1e6 / elapsed << " puzzles/s" << std::endl;
+    }
+
+    std::cerr << "Latency (us):" << std::endl;
+
+    for(std::size_t b = 0; b < buckets; ++b){
+        if(histogram[b]){
+            std::size_t low = b ? std::size_t(1) << (b - 1) : 0;
+            std::size_t high = std::size_t(1) << b;
+
+            std::cerr << "\t[" << low << ", " << high << "): " << histogram[b] << std::endl;
+        }
+    }
+
+    return 0;
+}
+
 } //end of anonymous namespace
 
 int main(int argc, char** argv){
@@ -1196,6 +1400,10 @@ int main(int argc, char** argv){
         return command_train(conf);
     } else if(conf.command == "recog" || conf.command == "recog_binary"){
         return command_recog(conf);
+    } else if(conf.command == "serve"){
+        return command_serve(conf);
+    } else if(conf.command == "solve"){
+        return command_solve(conf);
     } else if(conf.command == "test"){
         return command_test(conf);
     } else if(conf.command == "time"){